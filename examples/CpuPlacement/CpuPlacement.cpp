@@ -0,0 +1,54 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/Profiler.hpp"
+#include <iostream>
+#include <thread>
+#include <vector>
+
+double compute(int n)
+{
+    JEB_PROFILE();
+    double sum = 0;
+    for (int i = 1; i <= n; ++i)
+        sum += 1.0 / i;
+    return sum;
+}
+
+double sleep_and_compute(int n)
+{
+    JEB_PROFILE();
+    // Sleeping gives the scheduler a chance to move the thread.
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    return compute(n);
+}
+
+void worker(double& result)
+{
+    for (int i = 0; i < 200; ++i)
+    {
+        result += compute(10000);
+        result += sleep_and_compute(10000);
+    }
+}
+
+int main()
+{
+    if (!JEBDebug::Profiler::instance().enable_cpu_tracking())
+        std::cout << "CPU tracking is not supported on this system.\n";
+
+    auto count = std::max(2u, std::thread::hardware_concurrency());
+    std::vector<double> results(count);
+    std::vector<std::thread> threads;
+    for (auto& result : results)
+        threads.emplace_back(worker, std::ref(result));
+    for (auto& thread : threads)
+        thread.join();
+
+    JEB_PROFILER_REPORT();
+    return 0;
+}
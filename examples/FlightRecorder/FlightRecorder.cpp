@@ -0,0 +1,64 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/FlightRecorder.hpp"
+#include "JEBDebug/Profiler.hpp"
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #include <io.h>
+    #define STDOUT_FILENO 1
+    #define STDERR_FILENO 2
+#else
+    #include <unistd.h>
+#endif
+
+int fibonacci(int n)
+{
+    JEB_PROFILE();
+    if (n <= 1)
+        return n;
+    return fibonacci(n - 1) + fibonacci(n - 2);
+}
+
+void worker(int id)
+{
+    JEB_PROFILE();
+    JEB_MESSAGE("worker " << id << " started");
+    auto result = fibonacci(4 + id);
+    JEB_MESSAGE("worker " << id << " computed " << result);
+}
+
+int overflow_stack(int n)
+{
+    volatile char data[1024];
+    data[0] = char(n);
+    if (n >= 0)
+        return overflow_stack(n + 1) + data[0];
+    return 0;
+}
+
+// Run with the argument "crash" to overflow the stack and let the crash
+// handler write the events to stderr.
+int main(int argc, char* argv[])
+{
+    JEBDebug::FlightRecorder::instance().enable(STDERR_FILENO);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; ++i)
+        threads.emplace_back(worker, i);
+    for (auto& thread : threads)
+        thread.join();
+
+    if (argc == 2 && std::strcmp(argv[1], "crash") == 0)
+        return overflow_stack(0);
+
+    JEBDebug::FlightRecorder::instance().dump(STDOUT_FILENO);
+    return 0;
+}
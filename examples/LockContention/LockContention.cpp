@@ -0,0 +1,52 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/ProfiledMutex.hpp"
+#include <map>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+JEBDebug::ProfiledMutex counter_mutex("counter");
+JEBDebug::ProfiledSharedMutex table_mutex("table");
+
+long counter = 0;
+std::map<int, int> table;
+
+void worker(int id)
+{
+    int hits = 0;
+    for (int i = 0; i < 20000; ++i)
+    {
+        if (i % 100 == id)
+        {
+            std::lock_guard lock(table_mutex);
+            table[i] = id;
+        }
+        else
+        {
+            std::shared_lock lock(table_mutex);
+            if (table.find(i) != table.end())
+                ++hits;
+        }
+        std::lock_guard lock(counter_mutex);
+        ++counter;
+    }
+    std::lock_guard lock(counter_mutex);
+    counter += hits;
+}
+
+int main()
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+        threads.emplace_back(worker, i);
+    for (auto& thread : threads)
+        thread.join();
+    JEB_PROFILER_REPORT();
+    return 0;
+}
@@ -4,11 +4,33 @@
 
 #define JEB_INSTANTIATE_PROFILER
 #include "JEBDebug/Profiler.hpp"
+#include "JEBDebug/Compare.hpp"
 #include "JEBDebug/Debug.hpp"
 #include <iostream>
 #include "fibonacci_it.hpp"
 #include "fibonacci_rec.hpp"
 
+// Uninstrumented versions for JEB_COMPARE, which would otherwise also
+// measure the profiler and add its calls to the report.
+long plain_fibonacci_rec(long n)
+{
+    if (n <= 1)
+        return 1;
+    else
+        return plain_fibonacci_rec(n - 1) + plain_fibonacci_rec(n - 2);
+}
+
+long plain_fibonacci_it(long n)
+{
+    long a = 1, b = 1;
+    for (long i = 1; i < n; ++i)
+    {
+        long tmp = b;
+        b = a;
+        a += tmp;
+    }
+    return a;
+}
 
 int main()
 {
@@ -20,5 +42,10 @@ int main()
         JEB_SHOW(n, fibonacci_rec(n), fibonacci_it(n));
     }
     JEB_PROFILER_REPORT();
+
+    // Volatile to keep the compiler from computing the results in advance.
+    volatile long m = 20;
+    JEB_COMPARE("fibonacci_rec(20)", [&] {return plain_fibonacci_rec(m);},
+                "fibonacci_it(20)", [&] {return plain_fibonacci_it(m);});
     return 0;
 }
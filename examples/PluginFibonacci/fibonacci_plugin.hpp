@@ -0,0 +1,10 @@
+//
+// Created by JBreimo on 08.06.2023.
+//
+
+#ifndef JEBDEBUG_FIBONACCI_PLUGIN_HPP
+#define JEBDEBUG_FIBONACCI_PLUGIN_HPP
+
+long fibonacci_rec(long n);
+
+#endif //JEBDEBUG_FIBONACCI_PLUGIN_HPP
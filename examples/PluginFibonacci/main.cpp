@@ -0,0 +1,49 @@
+//
+// Created by JBreimo on 08.06.2023.
+//
+
+#include "JEBDebug/Profiler.hpp"
+#include "JEBDebug/Debug.hpp"
+#include "fibonacci_plugin.hpp"
+
+#ifdef _WIN32
+    #define STDOUT_FILENO 1
+#endif
+
+long fibonacci_it(long n)
+{
+    JEB_PROFILE();
+    long a = 1, b = 1;
+    for (long i = 1; i < n; ++i)
+    {
+        long tmp = b;
+        b = a;
+        a += tmp;
+    }
+    return a;
+}
+
+int main()
+{
+    {
+        const int n = 27;
+        JEB_PROFILE();
+        JEB_COUNT("calls", 2);
+        JEB_SHOW(n, fibonacci_rec(n), fibonacci_it(n));
+    }
+    JEB_PROFILER_REPORT();
+
+    // Sections in both the executable and the plugin are recorded by the
+    // runtime's flight recorder.
+    auto& recorder = JEBDebug::FlightRecorder::instance();
+    recorder.enable();
+    {
+        JEB_PROFILE_NAMED("recorded");
+        JEB_MESSAGE("computing fibonacci(3) twice");
+        fibonacci_rec(3);
+        fibonacci_it(3);
+    }
+    std::cout.flush();
+    recorder.dump(STDOUT_FILENO);
+    return 0;
+}
@@ -0,0 +1,43 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/Profiler.hpp"
+#include "JEBDebug/ProfilerSampler.hpp"
+#include <cmath>
+#include <iostream>
+
+double profiled_sum(int n)
+{
+    JEB_PROFILE();
+    double sum = 0;
+    for (int i = 1; i <= n; ++i)
+        sum += std::sqrt(double(i));
+    return sum;
+}
+
+// Not profiled, samples taken here are reported by address.
+double unprofiled_sum(int n)
+{
+    double sum = 0;
+    for (int i = 1; i <= n; ++i)
+        sum += std::log(double(i));
+    return sum;
+}
+
+int main()
+{
+    JEB_SAMPLE_THREAD();
+    double total = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        total += profiled_sum(2000000);
+        total += unprofiled_sum(2000000);
+    }
+    std::cout << "total = " << total << "\n";
+    JEB_PROFILER_REPORT();
+    return 0;
+}
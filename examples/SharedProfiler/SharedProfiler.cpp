@@ -0,0 +1,55 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/ProfilerSharedMemory.hpp"
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+long fibonacci_rec(long n)
+{
+    JEB_PROFILE();
+    if (n <= 1)
+        return 1;
+    else
+        return fibonacci_rec(n - 1) + fibonacci_rec(n - 2);
+}
+
+int main()
+{
+    // The name is unique for each run to keep concurrent runs apart.
+    auto name = "JEBDebugExample" + std::to_string(getpid());
+    if (!JEBDebug::SharedProfiler::instance().enable(name))
+    {
+        std::cerr << "Unable to create the shared memory segment.\n";
+        return 1;
+    }
+
+    // Each worker process profiles its own calls, and its timings
+    // remain in the segment after it has exited.
+    for (long n = 18; n < 22; ++n)
+    {
+        if (fork() == 0)
+        {
+            fibonacci_rec(n);
+            _exit(0);
+        }
+    }
+    while (wait(nullptr) > 0)
+    {}
+
+    JEBDebug::SharedProfilerReader reader;
+    if (reader.open(name))
+    {
+        // The totals of all processes, followed by a table per process.
+        reader.write(std::cout, false);
+        reader.write(std::cout, true);
+    }
+    JEBDebug::SharedProfilerSegment::remove(name);
+    return 0;
+}
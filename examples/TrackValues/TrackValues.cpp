@@ -0,0 +1,36 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/Profiler.hpp"
+#include <random>
+#include <thread>
+#include <vector>
+
+void process_batches(unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::geometric_distribution<int> batch_size(0.05);
+    std::normal_distribution<double> latency(1.0, 0.25);
+    for (int i = 0; i < 100000; ++i)
+    {
+        JEB_TRACK(batch_size(random));
+        JEB_TRACK(latency(random));
+    }
+}
+
+int main()
+{
+    // Each thread records its values separately, and the report merges
+    // them into one distribution per call site.
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < 4; ++i)
+        threads.emplace_back(process_batches, i);
+    for (auto& thread : threads)
+        thread.join();
+    JEB_PROFILER_REPORT();
+    return 0;
+}
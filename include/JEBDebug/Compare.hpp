@@ -0,0 +1,295 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Debug.hpp"
+
+// The number of times each callable is timed by JEB_COMPARE.
+#ifndef JEB_COMPARE_ROUNDS
+    #define JEB_COMPARE_ROUNDS 30
+#endif
+
+// The minimum duration in seconds of each timed run. Callables that are
+// faster than this are called several times per run.
+#ifndef JEB_COMPARE_MIN_RUN_TIME
+    #define JEB_COMPARE_MIN_RUN_TIME 0.001
+#endif
+
+namespace JEBDebug
+{
+    struct CompareOptions
+    {
+        size_t rounds = JEB_COMPARE_ROUNDS;
+        double min_run_time = JEB_COMPARE_MIN_RUN_TIME;
+        /// The number of resamples used for the confidence interval.
+        size_t bootstrap_samples = 2000;
+        double confidence = 0.95;
+    };
+
+    /**
+     * @brief The result of comparing the running times of two callables.
+     *
+     * All times are in seconds per call.
+     */
+    struct CompareResult
+    {
+        std::string label_a;
+        std::string label_b;
+        std::vector<double> times_a;
+        std::vector<double> times_b;
+        /// The number of calls in each timed run of fn_a and fn_b.
+        size_t calls_a = 0;
+        size_t calls_b = 0;
+        double median_a = 0;
+        double median_b = 0;
+        /// median_b / median_a.
+        double ratio = 0;
+        /// The bootstrap confidence interval of ratio.
+        double ratio_low = 0;
+        double ratio_high = 0;
+        double confidence = 0;
+        /// The two-sided p-value of the Mann-Whitney U test.
+        double p_value = 1;
+
+        void write(std::ostream& os) const
+        {
+            auto flags = os.flags();
+            auto precision = os.precision(4);
+            os << std::defaultfloat;
+            auto width = int(std::max(label_a.size(), label_b.size()));
+            os << "\t" << std::left << std::setw(width) << label_a
+               << "  median " << median_a << " s\n"
+               << "\t" << std::setw(width) << label_b
+               << "  median " << median_b << " s\n"
+               << "\t" << label_b << " / " << label_a << " = " << ratio
+               << " (" << confidence * 100 << "% CI " << ratio_low
+               << " - " << ratio_high << "), Mann-Whitney p = " << p_value
+               << "\n\t" << times_a.size() << " runs of " << calls_a
+               << " and " << calls_b << " call(s)" << std::endl;
+            os.precision(precision);
+            os.flags(flags);
+        }
+    };
+
+    namespace internal
+    {
+        template <typename T>
+        void keep_result(const T& value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            asm volatile("" : : "r"(&value) : "memory");
+#else
+            static const void* volatile sink;
+            sink = &value;
+#endif
+        }
+
+        template <typename Fn>
+        double time_calls(Fn& fn, size_t calls)
+        {
+            CpuTimer timer;
+            timer.start();
+            for (size_t i = 0; i < calls; ++i)
+            {
+                if constexpr (std::is_void_v<decltype(fn())>)
+                {
+                    fn();
+                }
+                else
+                {
+                    auto&& result = fn();
+                    keep_result(result);
+                }
+            }
+            timer.stop();
+            return timer.seconds();
+        }
+
+        /**
+         * @brief Returns the number of calls to @a fn that take at least
+         *  @a min_time seconds.
+         */
+        template <typename Fn>
+        size_t calibrate_calls(Fn& fn, double min_time)
+        {
+            size_t calls = 1;
+            while (calls < (size_t(1) << 30u)
+                   && time_calls(fn, calls) < min_time)
+            {
+                calls *= 2;
+            }
+            return calls;
+        }
+
+        inline double median(std::vector<double> values)
+        {
+            if (values.empty())
+                return 0;
+            auto mid = values.begin() + values.size() / 2;
+            std::nth_element(values.begin(), mid, values.end());
+            if (values.size() % 2 != 0)
+                return *mid;
+            return (*mid + *std::max_element(values.begin(), mid)) / 2;
+        }
+
+        /**
+         * @brief Returns the two-sided p-value of the Mann-Whitney U test
+         *  with the normal approximation, corrected for ties.
+         */
+        inline double mann_whitney_p(const std::vector<double>& a,
+                                     const std::vector<double>& b)
+        {
+            std::vector<std::pair<double, bool>> values;
+            for (auto v : a)
+                values.emplace_back(v, true);
+            for (auto v : b)
+                values.emplace_back(v, false);
+            std::sort(values.begin(), values.end());
+
+            auto n = double(values.size());
+            double rank_sum_a = 0;
+            double tie_sum = 0;
+            for (size_t i = 0; i < values.size();)
+            {
+                auto j = i;
+                while (j < values.size() && values[j].first == values[i].first)
+                    ++j;
+                // Tied values get the mean of their ranks.
+                auto rank = double(i + j + 1) / 2;
+                for (auto k = i; k < j; ++k)
+                {
+                    if (values[k].second)
+                        rank_sum_a += rank;
+                }
+                auto t = double(j - i);
+                tie_sum += t * t * t - t;
+                i = j;
+            }
+
+            auto n_a = double(a.size());
+            auto n_b = double(b.size());
+            auto u = rank_sum_a - n_a * (n_a + 1) / 2;
+            auto mean = n_a * n_b / 2;
+            auto variance = n_a * n_b / 12
+                            * ((n + 1) - tie_sum / (n * (n - 1)));
+            if (variance <= 0)
+                return 1;
+            auto z = std::max(std::abs(u - mean) - 0.5, 0.0)
+                     / std::sqrt(variance);
+            return std::erfc(z / std::sqrt(2.0));
+        }
+    }
+
+    /**
+     * @brief Compares the running times of @a fn_a and @a fn_b.
+     *
+     * Each callable is first called repeatedly to warm up caches and
+     * to find the number of calls that makes each of its runs last at
+     * least options.min_run_time. They are then timed in options.rounds pairs
+     * of runs, with a random order within each pair, so that frequency
+     * scaling and other drift affect both equally.
+     */
+    template <typename FnA, typename FnB>
+    CompareResult compare(std::string label_a, FnA&& fn_a,
+                          std::string label_b, FnB&& fn_b,
+                          const CompareOptions& options = {})
+    {
+        using internal::time_calls, internal::median;
+
+        CompareResult result;
+        result.label_a = std::move(label_a);
+        result.label_b = std::move(label_b);
+        result.confidence = options.confidence;
+
+        auto calls_a = internal::calibrate_calls(fn_a, options.min_run_time);
+        auto calls_b = internal::calibrate_calls(fn_b, options.min_run_time);
+        result.calls_a = calls_a;
+        result.calls_b = calls_b;
+
+        std::mt19937_64 random(std::random_device{}());
+        for (size_t i = 0; i < options.rounds; ++i)
+        {
+            double time_a, time_b;
+            if (random() % 2 == 0)
+            {
+                time_a = time_calls(fn_a, calls_a);
+                time_b = time_calls(fn_b, calls_b);
+            }
+            else
+            {
+                time_b = time_calls(fn_b, calls_b);
+                time_a = time_calls(fn_a, calls_a);
+            }
+            result.times_a.push_back(time_a / double(calls_a));
+            result.times_b.push_back(time_b / double(calls_b));
+        }
+
+        if (options.rounds == 0)
+            return result;
+
+        result.median_a = median(result.times_a);
+        result.median_b = median(result.times_b);
+        auto ratio = [](double b, double a)
+        {
+            return a > 0 ? b / a : 0.0;
+        };
+        result.ratio = ratio(result.median_b, result.median_a);
+
+        // Percentile bootstrap of the ratio of medians.
+        std::vector<double> ratios;
+        std::vector<double> sample_a(options.rounds), sample_b(options.rounds);
+        std::uniform_int_distribution<size_t> index(0, options.rounds - 1);
+        for (size_t i = 0; i < options.bootstrap_samples; ++i)
+        {
+            for (size_t j = 0; j < options.rounds; ++j)
+            {
+                sample_a[j] = result.times_a[index(random)];
+                sample_b[j] = result.times_b[index(random)];
+            }
+            ratios.push_back(ratio(median(sample_b), median(sample_a)));
+        }
+        if (!ratios.empty())
+        {
+            std::sort(ratios.begin(), ratios.end());
+            auto tail = (1 - options.confidence) / 2;
+            auto last = double(ratios.size() - 1);
+            result.ratio_low = ratios[size_t(std::round(tail * last))];
+            result.ratio_high = ratios[size_t(std::round((1 - tail) * last))];
+        }
+
+        result.p_value = internal::mann_whitney_p(result.times_a,
+                                                  result.times_b);
+        return result;
+    }
+}
+
+/**
+ * @brief Compares the running times of two callables and writes the
+ *  ratio of their medians with a confidence interval and the p-value
+ *  of a Mann-Whitney U test.
+ *
+ * @a fn_a and @a fn_b must be enclosed in parentheses if they contain
+ * commas, e.g. lambdas with several captures.
+ */
+#define JEB_COMPARE(label_a, fn_a, label_b, fn_b) \
+    do { \
+        auto _jebdebug_result = ::JEBDebug::compare(label_a, fn_a, \
+                                                    label_b, fn_b); \
+        ::JEBDebug::STREAM() << _JEBDEBUG_STREAM_LOCATION() << ":\n"; \
+        _jebdebug_result.write(::JEBDebug::STREAM()); \
+    } while (false)
@@ -13,6 +13,7 @@
 #include <iterator>
 #include <ostream>
 #include <string>
+
 #if defined(_WIN32) && defined(JEBDEBUG_STREAM_TO_DEBUGGER)
     #include <sstream>
     #ifndef NOMINMAX
@@ -107,6 +108,8 @@ namespace JEBDebug
         ::JEBDebug::STREAM() << _JEBDEBUG_STREAM_LOCATION() << std::endl; \
     } while (false)
 
+// FlightRecorder.hpp replaces this with a JEB_MESSAGE that also records
+// the message.
 #define JEB_MESSAGE(msg) \
     do { \
         ::JEBDebug::STREAM() << _JEBDEBUG_STREAM_LOCATION() \
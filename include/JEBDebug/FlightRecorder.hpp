@@ -0,0 +1,751 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+#include <thread>
+#include "Debug.hpp"
+#include "ProfilerRuntime.h"
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define INTERNAL_JEB_FLIGHT_RECORDER_HAS_SIGACTION
+    #include <signal.h>
+#endif
+
+// With JEB_PROFILER_USE_RUNTIME, the recorder and the thread buffers
+// belong to the compiled profiler runtime.
+#if defined(JEB_PROFILER_USE_RUNTIME) && !defined(JEB_PROFILER_BUILDING_RUNTIME)
+    #define INTERNAL_JEB_FLIGHT_RECORDER_FROM_RUNTIME
+#endif
+
+// The runtime's own copies of the profiler and the flight recorder are
+// put in an inline namespace. Their inline functions are defined
+// differently than in the code that uses the runtime, and must not be
+// merged with those when a program links with the static runtime. The
+// namespace must not contain a namespace internal, as that would make
+// JEBDebug::internal ambiguous.
+#ifdef JEB_PROFILER_BUILDING_RUNTIME
+    #define INTERNAL_JEB_PROFILER_BEGIN_RUNTIME_NAMESPACE inline namespace Runtime {
+    #define INTERNAL_JEB_PROFILER_END_RUNTIME_NAMESPACE }
+#else
+    #define INTERNAL_JEB_PROFILER_BEGIN_RUNTIME_NAMESPACE
+    #define INTERNAL_JEB_PROFILER_END_RUNTIME_NAMESPACE
+#endif
+
+// The number of events kept for each thread. Must be a power of two. Each
+// event uses 16 bytes.
+#ifndef JEB_FLIGHT_RECORDER_EVENTS
+    #define JEB_FLIGHT_RECORDER_EVENTS 4096
+#endif
+
+// The maximum number of threads that record events at the same time.
+#ifndef JEB_FLIGHT_RECORDER_MAX_THREADS
+    #define JEB_FLIGHT_RECORDER_MAX_THREADS 256
+#endif
+
+// The maximum number of characters that are recorded for each message.
+#ifndef JEB_FLIGHT_RECORDER_MESSAGE_SIZE
+    #define JEB_FLIGHT_RECORDER_MESSAGE_SIZE 256
+#endif
+
+// The size in bytes of the alternate signal stack of each recording thread.
+#ifndef JEB_FLIGHT_RECORDER_SIGNAL_STACK_SIZE
+    #define JEB_FLIGHT_RECORDER_SIGNAL_STACK_SIZE 65536
+#endif
+
+namespace JEBDebug
+{
+    namespace internal
+    {
+        /**
+         * @brief Returns the FNV-1a hash of @a values.
+         *
+         * Used to check that code using the compiled runtime has the
+         * same configuration as the runtime.
+         */
+        constexpr uint64_t hash_config(std::initializer_list<uint64_t> values)
+        {
+            uint64_t hash = 0xCBF29CE484222325u;
+            for (auto value : values)
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    hash ^= (value >> (8 * i)) & 0xFFu;
+                    hash *= 0x100000001B3u;
+                }
+            }
+            return hash;
+        }
+    }
+
+INTERNAL_JEB_PROFILER_BEGIN_RUNTIME_NAMESPACE
+    /**
+     * @brief Writes text to a file descriptor through a fixed buffer.
+     *
+     * All functions are async-signal-safe.
+     */
+    class FlightRecorderWriter
+    {
+    public:
+        explicit FlightRecorderWriter(int fd)
+            : fd_(fd)
+        {}
+
+        FlightRecorderWriter(const FlightRecorderWriter&) = delete;
+
+        FlightRecorderWriter& operator=(const FlightRecorderWriter&) = delete;
+
+        ~FlightRecorderWriter()
+        {
+            flush();
+        }
+
+        FlightRecorderWriter& operator<<(char c)
+        {
+            if (size_ == sizeof(buffer_))
+                flush();
+            buffer_[size_++] = c;
+            return *this;
+        }
+
+        FlightRecorderWriter& operator<<(std::string_view text)
+        {
+            for (auto c : text)
+                *this << c;
+            return *this;
+        }
+
+        FlightRecorderWriter& operator<<(const char* text)
+        {
+            return *this << std::string_view(text);
+        }
+
+        FlightRecorderWriter& operator<<(uint64_t value)
+        {
+            char digits[20];
+            size_t n = 0;
+            do
+            {
+                digits[n++] = char('0' + value % 10);
+                value /= 10;
+            } while (value != 0);
+            while (n != 0)
+                *this << digits[--n];
+            return *this;
+        }
+
+        void flush()
+        {
+            const char* data = buffer_;
+            while (size_ != 0)
+            {
+#ifdef _WIN32
+                auto n = _write(fd_, data, unsigned(size_));
+#else
+                auto n = ::write(fd_, data, size_);
+#endif
+                if (n <= 0)
+                    break;
+                data += n;
+                size_ -= size_t(n);
+            }
+            size_ = 0;
+        }
+    private:
+        int fd_;
+        char buffer_[1024];
+        size_t size_ = 0;
+    };
+
+    /**
+     * @brief Keeps the most recent profiler events and debug messages of
+     *  each thread, and writes them to a file if the program crashes.
+     *
+     * Each thread writes to its own fixed-size ring buffer. Recording an
+     * event is a handful of plain stores and a release store, and never
+     * takes a lock or allocates memory. The buffers of all
+     * JEB_FLIGHT_RECORDER_MAX_THREADS threads are allocated by the first
+     * call to enable(), and each thread claims one the first time it
+     * records an event.
+     *
+     * On POSIX systems each buffer also has an alternate signal stack,
+     * which is installed for the thread that claims it, unless the thread
+     * already has one. This lets the crash handlers run after a stack
+     * overflow.
+     *
+     * The recorder does nothing until enable() is called.
+     */
+    class FlightRecorder
+    {
+    public:
+        /**
+         * @brief Writes a description of the key passed to record_enter
+         *  and record_exit. Must be async-signal-safe.
+         */
+        using KeyWriter = void (*)(const void* key, FlightRecorderWriter& out);
+
+        static FlightRecorder& instance()
+        {
+#ifdef INTERNAL_JEB_FLIGHT_RECORDER_FROM_RUNTIME
+            // Initialized by the first call, which is never in a signal
+            // handler as the recorder must be enabled first.
+            static auto& recorder = *static_cast<FlightRecorder*>(
+                jeb_flight_recorder(config_hash()));
+            return recorder;
+#else
+            // Constant-initialized, which makes it safe to use in signal
+            // handlers and during static initialization and destruction.
+            static FlightRecorder recorder;
+            return recorder;
+#endif
+        }
+
+        /**
+         * @brief Returns a hash of the recorder's configuration macros
+         *  and layout.
+         */
+        [[nodiscard]] static constexpr uint64_t config_hash()
+        {
+            return internal::hash_config({
+                sizeof(FlightRecorder),
+                sizeof(ThreadBuffer),
+                JEB_FLIGHT_RECORDER_EVENTS,
+                JEB_FLIGHT_RECORDER_MAX_THREADS,
+                JEB_FLIGHT_RECORDER_MESSAGE_SIZE,
+                JEB_FLIGHT_RECORDER_SIGNAL_STACK_SIZE});
+        }
+
+        [[nodiscard]] static bool is_enabled()
+        {
+            return instance().enabled_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Starts recording events.
+         *
+         * If @a fd is a valid file descriptor, the events are written to
+         * it if the program receives SIGSEGV, SIGABRT, SIGBUS, SIGFPE or
+         * SIGILL, or if std::terminate is called. The file descriptor
+         * must remain open for the rest of the program.
+         */
+        void enable(int fd = -1)
+        {
+            if (!buffers_.load(std::memory_order_acquire))
+            {
+                auto* buffers = new ThreadBuffer[MAX_THREADS];
+                ThreadBuffer* expected = nullptr;
+                if (!buffers_.compare_exchange_strong(
+                        expected, buffers, std::memory_order_acq_rel))
+                {
+                    delete[] buffers;
+                }
+            }
+            fd_.store(fd, std::memory_order_relaxed);
+            if (fd >= 0 && !handlers_installed_.exchange(true))
+                install_crash_handlers();
+            thread_buffer();
+            enabled_.store(true, std::memory_order_release);
+        }
+
+        void disable()
+        {
+            enabled_.store(false, std::memory_order_relaxed);
+        }
+
+        void set_key_writer(KeyWriter writer)
+        {
+            key_writer_.store(writer, std::memory_order_relaxed);
+        }
+
+        template <typename TimePoint>
+        void record_enter(const void* key, TimePoint time)
+        {
+            record(ENTER, time, reinterpret_cast<uintptr_t>(key));
+        }
+
+        template <typename TimePoint>
+        void record_exit(const void* key, TimePoint time)
+        {
+            record(EXIT, time, reinterpret_cast<uintptr_t>(key));
+        }
+
+        /**
+         * @brief Records a message.
+         *
+         * @param location a string literal or another string that remains
+         *  valid for the rest of the program.
+         */
+        void record_message(const char* location, std::string_view text)
+        {
+            auto time = std::chrono::high_resolution_clock::now();
+            record(LOCATION, time, reinterpret_cast<uintptr_t>(location));
+            text = text.substr(0, std::min<size_t>(
+                text.size(), JEB_FLIGHT_RECORDER_MESSAGE_SIZE));
+            for (size_t i = 0; i < text.size(); i += 8)
+            {
+                uint64_t payload = 0;
+                std::memcpy(&payload, text.data() + i,
+                            std::min<size_t>(text.size() - i, 8));
+                record(TEXT, time, payload);
+            }
+        }
+
+        /**
+         * @brief Writes the recorded events of all threads to @a fd.
+         *
+         * Async-signal-safe. Events that are recorded while the dump is
+         * in progress may be garbled.
+         */
+        void dump(int fd) const
+        {
+            FlightRecorderWriter out(fd);
+            const auto* buffers = buffers_.load(std::memory_order_acquire);
+            auto count = buffers ? claimed_buffers() : 0;
+            uint64_t newest = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const auto& buffer = buffers[i];
+                auto head = buffer.head.load(std::memory_order_acquire);
+                if (head != 0)
+                {
+                    const auto& last = buffer.events[(head - 1) % SIZE];
+                    newest = std::max(newest, time_of(last));
+                }
+            }
+
+            out << "flight recorder, times in microseconds before the last event\n";
+            for (size_t i = 0; i < count; ++i)
+                dump(out, buffers[i], newest);
+            if (auto n = thread_overflows_.load(std::memory_order_relaxed))
+            {
+                out << n << " thread(s) did not fit in"
+                    " JEB_FLIGHT_RECORDER_MAX_THREADS\n";
+            }
+        }
+    private:
+        enum EventType : uint64_t
+        {
+            ENTER = 1,
+            EXIT = 2,
+            LOCATION = 3,
+            TEXT = 4
+        };
+
+        struct Event
+        {
+            /// The event type in the top 8 bits, the time in nanoseconds in
+            /// the rest.
+            uint64_t header;
+            /// A key, a pointer to a location string or up to 8 characters.
+            uint64_t payload;
+        };
+
+        static constexpr size_t SIZE = JEB_FLIGHT_RECORDER_EVENTS;
+        static_assert((SIZE & (SIZE - 1)) == 0,
+                      "JEB_FLIGHT_RECORDER_EVENTS must be a power of two.");
+        static constexpr uint64_t TIME_MASK = (uint64_t(1) << 56u) - 1;
+        static constexpr size_t MAX_THREADS = JEB_FLIGHT_RECORDER_MAX_THREADS;
+
+        /// The events and the signal stack are left uninitialized to keep
+        /// the memory of unclaimed buffers untouched.
+        struct ThreadBuffer
+        {
+            std::atomic<uint64_t> head = 0;
+            /// True until the buffer's thread exits. Buffers that haven't
+            /// been claimed yet are claimed by their index instead.
+            std::atomic<bool> in_use = true;
+            uint64_t thread_id = 0;
+            Event events[SIZE];
+#ifdef INTERNAL_JEB_FLIGHT_RECORDER_HAS_SIGACTION
+            bool has_signal_stack = false;
+            alignas(16) char signal_stack[JEB_FLIGHT_RECORDER_SIGNAL_STACK_SIZE];
+#endif
+        };
+
+        /// Releases the calling thread's buffer when the thread exits.
+        struct ThreadBufferOwner
+        {
+            ThreadBuffer* buffer = nullptr;
+
+            ~ThreadBufferOwner()
+            {
+                if (!buffer)
+                    return;
+#ifdef INTERNAL_JEB_FLIGHT_RECORDER_HAS_SIGACTION
+                if (buffer->has_signal_stack)
+                {
+                    stack_t stack = {};
+                    stack.ss_flags = SS_DISABLE;
+                    sigaltstack(&stack, nullptr);
+                }
+#endif
+                buffer->in_use.store(false, std::memory_order_release);
+            }
+        };
+
+        constexpr FlightRecorder() = default;
+
+        template <typename TimePoint>
+        void record(EventType type, TimePoint time, uint64_t payload)
+        {
+            auto* buffer = thread_buffer();
+            if (!buffer)
+                return;
+            using std::chrono::duration_cast, std::chrono::nanoseconds;
+            auto ns = uint64_t(duration_cast<nanoseconds>(
+                time.time_since_epoch()).count());
+            auto head = buffer->head.load(std::memory_order_relaxed);
+            auto& event = buffer->events[head % SIZE];
+            event.header = (uint64_t(type) << 56u) | (ns & TIME_MASK);
+            event.payload = payload;
+            buffer->head.store(head + 1, std::memory_order_release);
+        }
+
+        ThreadBuffer* thread_buffer()
+        {
+#ifdef INTERNAL_JEB_FLIGHT_RECORDER_FROM_RUNTIME
+            return static_cast<ThreadBuffer*>(
+                jeb_internal_flight_recorder_buffer());
+#else
+            thread_local ThreadBufferOwner owner;
+            if (!owner.buffer)
+                owner.buffer = claim_buffer();
+            return owner.buffer;
+#endif
+        }
+
+        friend void* ::jeb_internal_flight_recorder_buffer();
+
+        [[nodiscard]] size_t claimed_buffers() const
+        {
+            return std::min(next_buffer_.load(std::memory_order_acquire),
+                            MAX_THREADS);
+        }
+
+        /**
+         * @brief Returns an unused buffer.
+         *
+         * Buffers released by threads that have exited are only reused
+         * when all JEB_FLIGHT_RECORDER_MAX_THREADS buffers have been
+         * claimed, to keep their events for as long as possible.
+         */
+        ThreadBuffer* claim_buffer()
+        {
+            auto* buffers = buffers_.load(std::memory_order_acquire);
+            if (!buffers)
+                return nullptr;
+            ThreadBuffer* buffer = nullptr;
+            if (next_buffer_.load(std::memory_order_relaxed) < MAX_THREADS)
+            {
+                auto index = next_buffer_.fetch_add(1, std::memory_order_acq_rel);
+                if (index < MAX_THREADS)
+                    buffer = &buffers[index];
+            }
+            for (size_t i = 0; !buffer && i < MAX_THREADS; ++i)
+            {
+                if (!buffers[i].in_use.exchange(true, std::memory_order_acquire))
+                    buffer = &buffers[i];
+            }
+            if (!buffer)
+            {
+                thread_overflows_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            buffer->thread_id = std::hash<std::thread::id>()(
+                std::this_thread::get_id());
+            buffer->head.store(0, std::memory_order_release);
+            install_signal_stack(*buffer);
+            return buffer;
+        }
+
+        static uint64_t time_of(const Event& event)
+        {
+            return event.header & TIME_MASK;
+        }
+
+        void dump(FlightRecorderWriter& out, const ThreadBuffer& buffer,
+                  uint64_t newest) const
+        {
+            auto head = buffer.head.load(std::memory_order_acquire);
+            if (head == 0)
+                return;
+            out << "\nthread " << buffer.thread_id << '\n';
+            auto key_writer = key_writer_.load(std::memory_order_relaxed);
+            bool in_message = false;
+            for (auto i = head > SIZE ? head - SIZE : 0; i < head; ++i)
+            {
+                const auto& event = buffer.events[i % SIZE];
+                auto type = event.header >> 56u;
+                if (type == TEXT)
+                {
+                    char text[8];
+                    std::memcpy(text, &event.payload, sizeof(text));
+                    auto size = size_t(std::find(text, text + 8, '\0') - text);
+                    out << std::string_view(text, size);
+                    continue;
+                }
+                if (in_message)
+                    out << '\n';
+                in_message = false;
+
+                auto time = time_of(event);
+                out << (time > newest ? "+" : "-")
+                    << (time > newest ? time - newest : newest - time) / 1000
+                    << ' ';
+                if (type == LOCATION)
+                {
+                    out << reinterpret_cast<const char*>(event.payload) << ' ';
+                    in_message = true;
+                    continue;
+                }
+                out << (type == ENTER ? "> " : "< ");
+                if (key_writer)
+                    key_writer(reinterpret_cast<const void*>(event.payload), out);
+                else
+                    out << uint64_t(event.payload);
+                out << '\n';
+            }
+            if (in_message)
+                out << '\n';
+        }
+
+        void dump_on_crash()
+        {
+            if (dumped_.exchange(true))
+                return;
+            auto fd = fd_.load(std::memory_order_relaxed);
+            if (fd >= 0)
+                dump(fd);
+        }
+
+        static void terminate_handler()
+        {
+            auto& self = instance();
+            self.dump_on_crash();
+            if (self.previous_terminate_handler_)
+                self.previous_terminate_handler_();
+            std::abort();
+        }
+
+#ifdef INTERNAL_JEB_FLIGHT_RECORDER_HAS_SIGACTION
+        static constexpr int SIGNALS[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+
+        static void signal_handler(int signal_number)
+        {
+            auto& self = instance();
+            self.dump_on_crash();
+            // Restore the previous handler and raise the signal again to
+            // let it, or the default action, end the process.
+            for (size_t i = 0; i < std::size(SIGNALS); ++i)
+            {
+                if (SIGNALS[i] == signal_number)
+                    sigaction(signal_number, &self.previous_actions_[i], nullptr);
+            }
+            raise(signal_number);
+        }
+
+        /**
+         * @brief Makes @a buffer's signal stack the calling thread's
+         *  alternate signal stack, unless it already has one.
+         */
+        static void install_signal_stack(ThreadBuffer& buffer)
+        {
+            stack_t stack = {};
+            buffer.has_signal_stack = false;
+            if (sigaltstack(nullptr, &stack) != 0
+                || (stack.ss_flags & SS_DISABLE) == 0)
+            {
+                return;
+            }
+            stack.ss_sp = buffer.signal_stack;
+            stack.ss_size = sizeof(buffer.signal_stack);
+            stack.ss_flags = 0;
+            buffer.has_signal_stack = sigaltstack(&stack, nullptr) == 0;
+        }
+
+        void install_crash_handlers()
+        {
+            previous_terminate_handler_ = std::set_terminate(terminate_handler);
+            struct sigaction action = {};
+            action.sa_handler = signal_handler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_ONSTACK;
+            for (size_t i = 0; i < std::size(SIGNALS); ++i)
+                sigaction(SIGNALS[i], &action, &previous_actions_[i]);
+        }
+#else
+        using SignalHandler = void (*)(int);
+
+        static void install_signal_stack(ThreadBuffer&)
+        {}
+
+        static void signal_handler(int signal_number)
+        {
+            instance().dump_on_crash();
+            std::signal(signal_number, SIG_DFL);
+            std::raise(signal_number);
+        }
+
+        void install_crash_handlers()
+        {
+            previous_terminate_handler_ = std::set_terminate(terminate_handler);
+            std::signal(SIGSEGV, signal_handler);
+            std::signal(SIGABRT, signal_handler);
+            std::signal(SIGFPE, signal_handler);
+            std::signal(SIGILL, signal_handler);
+        }
+#endif
+
+        std::atomic<bool> enabled_ = false;
+        std::atomic<int> fd_ = -1;
+        std::atomic<bool> handlers_installed_ = false;
+        std::atomic<bool> dumped_ = false;
+        std::atomic<KeyWriter> key_writer_ = nullptr;
+        std::atomic<size_t> thread_overflows_ = 0;
+        std::atomic<ThreadBuffer*> buffers_ = nullptr;
+        std::atomic<size_t> next_buffer_ = 0;
+        std::terminate_handler previous_terminate_handler_ = nullptr;
+#ifdef INTERNAL_JEB_FLIGHT_RECORDER_HAS_SIGACTION
+        struct sigaction previous_actions_[std::size(SIGNALS)] = {};
+#endif
+    };
+INTERNAL_JEB_PROFILER_END_RUNTIME_NAMESPACE
+
+    namespace internal
+    {
+        /**
+         * @brief A stream buffer that passes everything on to another
+         *  stream buffer and keeps a copy of the first N characters.
+         */
+        template <size_t N>
+        class FlightRecorderTeeBuffer : public std::streambuf
+        {
+        public:
+            explicit FlightRecorderTeeBuffer(std::streambuf* target)
+                : target_(target)
+            {}
+
+            [[nodiscard]] std::string_view view() const
+            {
+                return {text_, size_};
+            }
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                if (traits_type::eq_int_type(ch, traits_type::eof()))
+                    return traits_type::not_eof(ch);
+                if (size_ < N)
+                    text_[size_++] = traits_type::to_char_type(ch);
+                return target_ ? target_->sputc(traits_type::to_char_type(ch))
+                               : ch;
+            }
+
+            std::streamsize xsputn(const char* s, std::streamsize n) override
+            {
+                auto count = std::min(size_t(n), N - size_);
+                std::copy(s, s + count, text_ + size_);
+                size_ += count;
+                return target_ ? target_->sputn(s, n) : n;
+            }
+
+            int sync() override
+            {
+                return target_ ? target_->pubsync() : 0;
+            }
+        private:
+            std::streambuf* target_;
+            char text_[N];
+            size_t size_ = 0;
+        };
+
+        /// Makes the buffer a base class of FlightRecorderStream to
+        /// ensure that it is constructed before std::ostream.
+        struct FlightRecorderStreamBase
+        {
+            explicit FlightRecorderStreamBase(std::streambuf* target)
+                : buffer(target)
+            {}
+
+            FlightRecorderTeeBuffer<JEB_FLIGHT_RECORDER_MESSAGE_SIZE> buffer;
+        };
+
+        /**
+         * @brief A stream that writes to @a os and, if the flight recorder
+         *  is enabled, records the first JEB_FLIGHT_RECORDER_MESSAGE_SIZE
+         *  characters in it when it is destroyed.
+         */
+        class FlightRecorderStream : private FlightRecorderStreamBase,
+                                     public std::ostream
+        {
+        public:
+            FlightRecorderStream(std::ostream& os, const char* location)
+                : FlightRecorderStreamBase(os.rdbuf()),
+                  std::ostream(FlightRecorder::is_enabled()
+                               ? static_cast<std::streambuf*>(&buffer)
+                               : os.rdbuf()),
+                  location_(location)
+            {
+                copyfmt(os);
+            }
+
+            ~FlightRecorderStream() override
+            {
+                flush();
+                if (rdbuf() == &buffer)
+                {
+                    FlightRecorder::instance().record_message(location_,
+                                                              buffer.view());
+                }
+            }
+        private:
+            const char* location_;
+        };
+    }
+}
+
+#ifdef _MSC_VER
+    #define _JEBDEBUG_RECORDER_LOCATION() \
+        __FILE__ "(" _JEBDEBUG_AS_STRING(__LINE__) "):"
+#else
+    #define _JEBDEBUG_RECORDER_LOCATION() \
+        __FILE__ ":" _JEBDEBUG_AS_STRING(__LINE__) ":"
+#endif
+
+// Replaces the JEB_MESSAGE from Debug.hpp. When the flight recorder is
+// enabled, the message is also recorded there.
+#undef JEB_MESSAGE
+#define JEB_MESSAGE(msg) \
+    do { \
+        auto& _jebdebug_os = ::JEBDebug::STREAM(); \
+        _jebdebug_os << _JEBDEBUG_STREAM_LOCATION() << ":\n\t"; \
+        { \
+            ::JEBDebug::internal::FlightRecorderStream _jebdebug_stream( \
+                _jebdebug_os, _JEBDEBUG_RECORDER_LOCATION()); \
+            _jebdebug_stream << msg; \
+        } \
+        _jebdebug_os << std::endl; \
+    } while (false)
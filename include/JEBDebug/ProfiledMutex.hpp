@@ -0,0 +1,210 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include "Profiler.hpp"
+
+// Only every JEB_PROFILER_LOCK_SAMPLE_RATE'th acquisition on each thread
+// is timed to measure hold times. Uncontended acquisitions that are not
+// sampled do not read the clock.
+#ifndef JEB_PROFILER_LOCK_SAMPLE_RATE
+    #define JEB_PROFILER_LOCK_SAMPLE_RATE 1
+#endif
+
+namespace JEBDebug
+{
+    /**
+     * @brief A mutex that records how long threads wait for it and how
+     *  long they hold it.
+     *
+     * Mutexes with the same name share their statistics, which are shown
+     * in the "locks" section of the profiler report. The class meets the
+     * requirements of Lockable (and SharedLockable when @a Mutex does), so
+     * it can be used with std::lock_guard, std::unique_lock,
+     * std::shared_lock and std::condition_variable_any.
+     *
+     * Shared hold times are measured for up to MAX_SHARED_HOLDS shared
+     * locks held by the same thread at the same time.
+     */
+    template <typename Mutex>
+    class BasicProfiledMutex
+    {
+    public:
+        explicit BasicProfiledMutex(std::string_view name)
+            : stats_(&Profiler::instance().lock_stats(name))
+        {}
+
+        BasicProfiledMutex(const BasicProfiledMutex&) = delete;
+
+        BasicProfiledMutex& operator=(const BasicProfiledMutex&) = delete;
+
+        void lock()
+        {
+            if (mutex_.try_lock())
+            {
+                acquired(TimePoint());
+                return;
+            }
+
+            auto waiters = waiters_.fetch_add(1, std::memory_order_relaxed) + 1;
+            auto start_time = Clock::now();
+            mutex_.lock();
+            auto end_time = Clock::now();
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+            stats_->add_wait(end_time - start_time, waiters);
+            acquired(end_time);
+        }
+
+        bool try_lock()
+        {
+            if (!mutex_.try_lock())
+                return false;
+            acquired(TimePoint());
+            return true;
+        }
+
+        void unlock()
+        {
+            auto hold_start = hold_start_;
+            if (hold_start == TimePoint())
+            {
+                mutex_.unlock();
+                return;
+            }
+            auto hold_time = Clock::now() - hold_start;
+            mutex_.unlock();
+            stats_->add_hold(hold_time);
+        }
+
+        void lock_shared()
+        {
+            if (mutex_.try_lock_shared())
+            {
+                acquired_shared(TimePoint());
+                return;
+            }
+
+            auto waiters = waiters_.fetch_add(1, std::memory_order_relaxed) + 1;
+            auto start_time = Clock::now();
+            mutex_.lock_shared();
+            auto end_time = Clock::now();
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+            stats_->add_wait(end_time - start_time, waiters);
+            acquired_shared(end_time);
+        }
+
+        bool try_lock_shared()
+        {
+            if (!mutex_.try_lock_shared())
+                return false;
+            acquired_shared(TimePoint());
+            return true;
+        }
+
+        void unlock_shared()
+        {
+            for (auto& hold : shared_holds())
+            {
+                if (hold.mutex != this)
+                    continue;
+                auto hold_time = Clock::now() - hold.start_time;
+                hold.mutex = nullptr;
+                mutex_.unlock_shared();
+                stats_->add_shared_hold(hold_time);
+                return;
+            }
+            mutex_.unlock_shared();
+        }
+    private:
+        using Clock = std::chrono::high_resolution_clock;
+        using TimePoint = Clock::time_point;
+
+        static bool is_sampled()
+        {
+            if constexpr (JEB_PROFILER_LOCK_SAMPLE_RATE <= 1)
+            {
+                return true;
+            }
+            else
+            {
+                thread_local unsigned counter = 0;
+                return counter++ % JEB_PROFILER_LOCK_SAMPLE_RATE == 0;
+            }
+        }
+
+        /**
+         * @brief Must be called while holding the lock.
+         *
+         * @param now the current time if the caller already has it,
+         *  otherwise TimePoint().
+         */
+        void acquired(TimePoint now)
+        {
+            stats_->add_acquisition();
+            if (!is_sampled())
+                hold_start_ = TimePoint();
+            else if (now != TimePoint())
+                hold_start_ = now;
+            else
+                hold_start_ = Clock::now();
+        }
+
+        /**
+         * @brief Must be called while holding a shared lock.
+         *
+         * @param now the current time if the caller already has it,
+         *  otherwise TimePoint().
+         */
+        void acquired_shared(TimePoint now)
+        {
+            stats_->add_acquisition();
+            if (!is_sampled())
+                return;
+            for (auto& hold : shared_holds())
+            {
+                if (hold.mutex)
+                    continue;
+                hold.mutex = this;
+                hold.start_time = now != TimePoint() ? now : Clock::now();
+                return;
+            }
+        }
+
+        static constexpr size_t MAX_SHARED_HOLDS = 8;
+
+        struct SharedHold
+        {
+            const BasicProfiledMutex* mutex = nullptr;
+            TimePoint start_time;
+        };
+
+        /// The sampled shared locks held by the calling thread.
+        static std::array<SharedHold, MAX_SHARED_HOLDS>& shared_holds()
+        {
+            thread_local std::array<SharedHold, MAX_SHARED_HOLDS> holds;
+            return holds;
+        }
+
+        Mutex mutex_;
+        LockStats* stats_;
+        std::atomic<size_t> waiters_ = 0;
+        /// The time the lock was acquired, or TimePoint() if the current
+        /// acquisition is not sampled. Only accessed by the lock holder.
+        TimePoint hold_start_;
+    };
+
+    using ProfiledMutex = BasicProfiledMutex<std::mutex>;
+
+    using ProfiledSharedMutex = BasicProfiledMutex<std::shared_mutex>;
+}
@@ -8,25 +8,94 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <chrono>
 #include <cmath>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <limits>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
 #include <vector>
+#include "FlightRecorder.hpp"
+#include "ProfilerCounters.hpp"
+#include "ProfilerLocks.hpp"
+#include "ProfilerPlacement.hpp"
+#include "ProfilerRuntime.hpp"
+#include "ProfilerTracking.hpp"
+#include "StringTable.hpp"
 
-#if !defined(JEB_INSTANTIATE_PROFILER) && !defined(JEB_SHARE_PROFILER)
+// With JEB_PROFILER_USE_RUNTIME, the profiler instance and the call
+// stacks belong to the compiled runtime library, which must be built
+// with the same JEB_PROFILER_* configuration macros. Sections are timed
+// through the runtime's C interface, and the configuration is checked
+// when the profiler is first used.
+#if defined(JEB_PROFILER_USE_RUNTIME) && !defined(JEB_PROFILER_BUILDING_RUNTIME)
+    #define INTERNAL_JEB_PROFILER_FROM_RUNTIME
+#elif !defined(JEB_INSTANTIATE_PROFILER) && !defined(JEB_SHARE_PROFILER)
     #define JEB_INSTANTIATE_PROFILER
 #endif
 
+// The number of slowest invocations that are kept for each section.
+#ifndef JEB_PROFILER_SLOWEST_CALLS
+    #define JEB_PROFILER_SLOWEST_CALLS 5
+#endif
+
+// The profiler never allocates memory after it has been constructed. The
+// following macros set the capacities of its tables. Sections and nested
+// timers that exceed the capacities are counted and shown in the report.
+
+// The maximum number of distinct sections.
+#ifndef JEB_PROFILER_MAX_SECTIONS
+    #define JEB_PROFILER_MAX_SECTIONS 1024
+#endif
+
+// The maximum number of nested active timers per thread.
+#ifndef JEB_PROFILER_MAX_DEPTH
+    #define JEB_PROFILER_MAX_DEPTH 256
+#endif
+
+// The maximum number of distinct section names, and the total number of
+// bytes available for storing them.
+#ifndef JEB_PROFILER_MAX_NAMES
+    #define JEB_PROFILER_MAX_NAMES 1024
+#endif
+
+#ifndef JEB_PROFILER_NAME_BUFFER_SIZE
+    #define JEB_PROFILER_NAME_BUFFER_SIZE 65536
+#endif
+
+// The number of different names that a single JEB_PROFILE_DYNAMIC can look
+// up without taking a lock.
+#ifndef JEB_PROFILER_MAX_NAMES_PER_SITE
+    #define JEB_PROFILER_MAX_NAMES_PER_SITE 64
+#endif
+
+// The maximum number of distinct ProfiledMutex names.
+#ifndef JEB_PROFILER_MAX_LOCKS
+    #define JEB_PROFILER_MAX_LOCKS 64
+#endif
+
+// The maximum length of tags set with JEB_PROFILE_TAG.
+#ifndef JEB_PROFILER_TAG_SIZE
+    #define JEB_PROFILER_TAG_SIZE 32
+#endif
+
 namespace JEBDebug
 {
+INTERNAL_JEB_PROFILER_BEGIN_RUNTIME_NAMESPACE
     class ProfilerSection
     {
     public:
+        ProfilerSection() = default;
+
         ProfilerSection(std::string_view file_name,
                         std::string_view func_name,
                         size_t line_no)
@@ -38,7 +107,7 @@ namespace JEBDebug
         std::string_view file_name;
         std::string_view func_name;
         std::string_view name;
-        size_t line_no;
+        size_t line_no = 0;
     };
 
     inline bool operator<(const ProfilerSection& a, const ProfilerSection& b)
@@ -62,16 +131,42 @@ namespace JEBDebug
            max_time_(-std::numeric_limits<Duration>::min())
         {}
 
+        ProfilerData(size_t count,
+                     Duration acc_time,
+                     Duration min_time,
+                     Duration max_time,
+                     Duration total_time = {},
+                     uint64_t bytes = 0,
+                     uint64_t items = 0)
+            : count_(count),
+              acc_time_(acc_time),
+              min_time_(min_time),
+              max_time_(max_time),
+              total_time_(total_time),
+              bytes_(bytes),
+              items_(items)
+        {}
+
         void add_time(Duration total_time, Duration time)
         {
             ++count_;
             acc_time_ += time;
+            total_time_ += total_time;
             if (total_time < min_time_)
                 min_time_ = total_time;
             if (total_time > max_time_)
                 max_time_ = total_time;
         }
 
+        /**
+         * @brief Adds the amount of work done by a call to the section.
+         */
+        void add_work(uint64_t bytes, uint64_t items)
+        {
+            bytes_ += bytes;
+            items_ += items;
+        }
+
         [[nodiscard]] size_t count() const
         {
             return count_;
@@ -94,62 +189,1176 @@ namespace JEBDebug
             using namespace std::chrono;
             return duration_cast<duration<double>>(max_time_).count();
         }
+
+        /**
+         * @brief Returns the time spent in the section including the
+         *  time spent in nested sections.
+         */
+        [[nodiscard]] double total_time() const
+        {
+            using namespace std::chrono;
+            return duration_cast<duration<double>>(total_time_).count();
+        }
+
+        [[nodiscard]] uint64_t bytes() const
+        {
+            return bytes_;
+        }
+
+        [[nodiscard]] uint64_t items() const
+        {
+            return items_;
+        }
+
+        [[nodiscard]] bool has_work() const
+        {
+            return bytes_ != 0 || items_ != 0;
+        }
     private:
         size_t count_;
         Duration acc_time_;
         Duration min_time_;
         Duration max_time_;
+        Duration total_time_ = {};
+        uint64_t bytes_ = 0;
+        uint64_t items_ = 0;
+    };
+
+    /**
+     * @brief The id of an interned section name.
+     */
+    class ProfilerName
+    {
+    public:
+        constexpr ProfilerName() = default;
+
+        constexpr explicit ProfilerName(StringTable::Id id)
+            : id_(id)
+        {}
+
+        [[nodiscard]] constexpr StringTable::Id id() const
+        {
+            return id_;
+        }
+    private:
+        StringTable::Id id_ = 0;
+    };
+
+    class ProfilerTag
+    {
+    public:
+        void set(std::string_view text)
+        {
+            size_ = std::min(text.size(), text_.size());
+            std::copy_n(text.begin(), size_, text_.begin());
+        }
+
+        template <typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+        void set(T value)
+        {
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                set(std::string_view(value ? "true" : "false"));
+            }
+            else
+            {
+                auto [end, ec] = std::to_chars(text_.data(),
+                                               text_.data() + text_.size(),
+                                               value);
+                size_ = ec == std::errc() ? size_t(end - text_.data()) : 0;
+            }
+        }
+
+        void clear()
+        {
+            size_ = 0;
+        }
+
+        [[nodiscard]] std::string_view view() const
+        {
+            return {text_.data(), size_};
+        }
+    private:
+        std::array<char, JEB_PROFILER_TAG_SIZE> text_ = {};
+        size_t size_ = 0;
+    };
+
+    struct ProfilerCall
+    {
+        using Clock = std::chrono::high_resolution_clock;
+
+        Clock::duration time;
+        Clock::time_point start_time;
+        std::thread::id thread_id;
+        ProfilerTag tag;
+    };
+
+    /**
+     * @brief Keeps the slowest invocations of a section in a min-heap.
+     *
+     * Callers must check is_candidate before calling add, for the vast
+     * majority of calls this is the only cost.
+     */
+    class SlowestCalls
+    {
+    public:
+        using Duration = ProfilerCall::Clock::duration;
+
+        [[nodiscard]] bool is_candidate(Duration time) const
+        {
+            return time.count() > threshold_.load(std::memory_order_relaxed);
+        }
+
+        void add(const ProfilerCall& call)
+        {
+            std::lock_guard lock(mutex_);
+            if (size_ < heap_.size())
+            {
+                heap_[size_++] = call;
+                std::push_heap(heap_.begin(), heap_.begin() + size_, is_faster);
+            }
+            else if (size_ != 0 && call.time > heap_[0].time)
+            {
+                std::pop_heap(heap_.begin(), heap_.end(), is_faster);
+                heap_.back() = call;
+                std::push_heap(heap_.begin(), heap_.end(), is_faster);
+            }
+            update_threshold();
+        }
+
+        /**
+         * @brief Returns the calls sorted from slowest to fastest.
+         */
+        [[nodiscard]] std::vector<ProfilerCall> snapshot() const
+        {
+            std::lock_guard lock(mutex_);
+            return sorted();
+        }
+
+        std::vector<ProfilerCall> take()
+        {
+            std::lock_guard lock(mutex_);
+            auto result = sorted();
+            size_ = 0;
+            update_threshold();
+            return result;
+        }
+    private:
+        static bool is_faster(const ProfilerCall& a, const ProfilerCall& b)
+        {
+            return a.time > b.time;
+        }
+
+        [[nodiscard]] std::vector<ProfilerCall> sorted() const
+        {
+            std::vector<ProfilerCall> result(heap_.begin(),
+                                             heap_.begin() + size_);
+            std::sort(result.begin(), result.end(), is_faster);
+            return result;
+        }
+
+        void update_threshold()
+        {
+            auto threshold = size_ == heap_.size() && size_ != 0
+                             ? heap_[0].time.count()
+                             : std::numeric_limits<Duration::rep>::min();
+            threshold_.store(threshold, std::memory_order_relaxed);
+        }
+
+        mutable std::mutex mutex_;
+        std::array<ProfilerCall, JEB_PROFILER_SLOWEST_CALLS> heap_;
+        size_t size_ = 0;
+        std::atomic<Duration::rep> threshold_ =
+            JEB_PROFILER_SLOWEST_CALLS != 0
+                ? std::numeric_limits<Duration::rep>::min()
+                : std::numeric_limits<Duration::rep>::max();
+    };
+
+    /**
+     * @brief Timing statistics for a section that are stored in memory
+     *  shared with other processes.
+     *
+     * Times are in nanoseconds to make the layout independent of the
+     * clock's resolution.
+     */
+    struct SharedSectionStats
+    {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> acc_time;
+        std::atomic<uint64_t> min_time;
+        std::atomic<uint64_t> max_time;
+
+        void reset()
+        {
+            count.store(0, std::memory_order_relaxed);
+            acc_time.store(0, std::memory_order_relaxed);
+            min_time.store(std::numeric_limits<uint64_t>::max(),
+                           std::memory_order_relaxed);
+            max_time.store(0, std::memory_order_relaxed);
+        }
+
+        template <typename Duration>
+        void add_time(Duration total_time, Duration time)
+        {
+            using std::chrono::duration_cast, std::chrono::nanoseconds;
+            auto total_ns = uint64_t(duration_cast<nanoseconds>(total_time).count());
+            count.fetch_add(1, std::memory_order_relaxed);
+            acc_time.fetch_add(uint64_t(duration_cast<nanoseconds>(time).count()),
+                               std::memory_order_relaxed);
+            internal::atomic_min(min_time, total_ns);
+            internal::atomic_max(max_time, total_ns);
+        }
     };
 
+    /**
+     * @brief The thread-safe counterpart of ProfilerData.
+     *
+     * All updates are lock-free, which allows one thread to take
+     * snapshots of the data while other threads keep updating it.
+     */
+    class ProfilerAccumulator
+    {
+    public:
+        using Duration = ProfilerData::Duration;
+
+        ProfilerAccumulator()
+            : count_(0),
+              acc_time_(0),
+              min_time_(std::numeric_limits<Rep>::max()),
+              max_time_(std::numeric_limits<Rep>::min())
+        {}
+
+        void add_time(Duration total_time, Duration time)
+        {
+            count_.fetch_add(1, std::memory_order_relaxed);
+            acc_time_.fetch_add(time.count(), std::memory_order_relaxed);
+            total_time_.fetch_add(total_time.count(), std::memory_order_relaxed);
+            internal::atomic_min(min_time_, total_time.count());
+            internal::atomic_max(max_time_, total_time.count());
+            if (auto* shared = shared_stats_.load(std::memory_order_relaxed))
+                shared->add_time(total_time, time);
+        }
+
+        void add_work(uint64_t bytes, uint64_t items)
+        {
+            if (bytes != 0)
+                bytes_.fetch_add(bytes, std::memory_order_relaxed);
+            if (items != 0)
+                items_.fetch_add(items, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Records the CPUs a call started and ended on, if CPU
+         *  tracking is enabled.
+         */
+        void add_placement(int start_cpu, int end_cpu)
+        {
+            if (auto* placement = placement_.load(std::memory_order_acquire))
+                placement->add(start_cpu, end_cpu);
+        }
+
+        void set_placement(SectionPlacement* placement)
+        {
+            // Publishes the initialized placement to add_placement on
+            // other threads.
+            placement_.store(placement, std::memory_order_release);
+        }
+
+        /**
+         * @brief Makes add_time also update @a stats, or stops it if
+         *  @a stats is nullptr.
+         */
+        void set_shared_stats(SharedSectionStats* stats)
+        {
+            shared_stats_.store(stats, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] ProfilerData snapshot() const
+        {
+            using std::memory_order_relaxed;
+            return {count_.load(memory_order_relaxed),
+                    Duration(acc_time_.load(memory_order_relaxed)),
+                    Duration(min_time_.load(memory_order_relaxed)),
+                    Duration(max_time_.load(memory_order_relaxed)),
+                    Duration(total_time_.load(memory_order_relaxed)),
+                    bytes_.load(memory_order_relaxed),
+                    items_.load(memory_order_relaxed)};
+        }
+
+        /**
+         * @brief Returns a snapshot of the data and resets the
+         *  accumulator.
+         */
+        ProfilerData take()
+        {
+            using std::memory_order_relaxed;
+            auto count = count_.exchange(0, memory_order_relaxed);
+            auto acc_time = acc_time_.exchange(0, memory_order_relaxed);
+            auto min_time = min_time_.exchange(
+                std::numeric_limits<Rep>::max(), memory_order_relaxed);
+            auto max_time = max_time_.exchange(
+                std::numeric_limits<Rep>::min(), memory_order_relaxed);
+            auto total_time = total_time_.exchange(0, memory_order_relaxed);
+            return {count, Duration(acc_time),
+                    Duration(min_time), Duration(max_time),
+                    Duration(total_time),
+                    bytes_.exchange(0, memory_order_relaxed),
+                    items_.exchange(0, memory_order_relaxed)};
+        }
+
+        /**
+         * @brief Counts a sample taken by the sampling profiler while
+         *  this section was the innermost active section.
+         *
+         * Async-signal-safe.
+         */
+        void add_sample()
+        {
+            samples_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] size_t samples() const
+        {
+            return samples_.load(std::memory_order_relaxed);
+        }
+
+        size_t take_samples()
+        {
+            return samples_.exchange(0, std::memory_order_relaxed);
+        }
+
+        SlowestCalls& slowest_calls()
+        {
+            return slowest_calls_;
+        }
+
+        [[nodiscard]] const SlowestCalls& slowest_calls() const
+        {
+            return slowest_calls_;
+        }
+    private:
+        using Rep = Duration::rep;
+
+        std::atomic<size_t> count_;
+        std::atomic<Rep> acc_time_;
+        std::atomic<Rep> min_time_;
+        std::atomic<Rep> max_time_;
+        std::atomic<Rep> total_time_ = 0;
+        std::atomic<uint64_t> bytes_ = 0;
+        std::atomic<uint64_t> items_ = 0;
+        std::atomic<size_t> samples_ = 0;
+        std::atomic<SharedSectionStats*> shared_stats_ = nullptr;
+        std::atomic<SectionPlacement*> placement_ = nullptr;
+        SlowestCalls slowest_calls_;
+    };
+
+    /**
+     * @brief Base class for components that need to know about every
+     *  section in the profiler.
+     */
+    class ProfilerSectionObserver
+    {
+    public:
+        virtual ~ProfilerSectionObserver() = default;
+
+        /**
+         * @brief Called once for each section, including the overflow
+         *  section.
+         *
+         * The profiler's section table is locked during the call, the
+         * function must therefore not call back into the profiler.
+         */
+        virtual void section_added(const ProfilerSection& section,
+                                   ProfilerAccumulator& data) = 0;
+    };
+
+    /**
+     * @brief Base class for components that add their own sections to
+     *  the profiler report.
+     */
+    class ProfilerReportSection
+    {
+    public:
+        virtual ~ProfilerReportSection() = default;
+
+        /**
+         * @brief Writes the section, and resets its data if @a reset is
+         *  true.
+         */
+        virtual void write(std::ostream& os, bool reset) = 0;
+
+        virtual void clear() = 0;
+
+        ProfilerReportSection* next = nullptr;
+    };
+
+    /**
+     * @brief Collects the timings of all profiled sections.
+     *
+     * Each thread has its own call stack, while the statistics for a
+     * section are shared by all threads. The section table is only
+     * locked when a section is seen for the first time and while a
+     * report is written; timing a section that is already known never
+     * blocks.
+     */
     class Profiler
     {
     public:
         static Profiler& instance()
         {
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+            static auto& profiler = *static_cast<Profiler*>(
+                jeb_profiler(config_hash()));
+            return profiler;
+#elif defined(JEB_PROFILER_BUILDING_RUNTIME)
+            // Constructed on first use, as programs that link with the
+            // runtime may use the profiler during their static
+            // initialization.
+            static Profiler profiler;
+            return profiler;
+#else
             return instance_;
+#endif
+        }
+
+        /**
+         * @brief Returns a hash of the profiler's configuration macros
+         *  and layout.
+         */
+        [[nodiscard]] static constexpr uint64_t config_hash()
+        {
+            return internal::hash_config({
+                sizeof(Profiler),
+                sizeof(CallStack),
+                sizeof(SectionEntry),
+                JEB_PROFILER_SLOWEST_CALLS,
+                JEB_PROFILER_MAX_SECTIONS,
+                JEB_PROFILER_MAX_DEPTH,
+                JEB_PROFILER_MAX_NAMES,
+                JEB_PROFILER_NAME_BUFFER_SIZE,
+                JEB_PROFILER_MAX_LOCKS,
+                JEB_PROFILER_TAG_SIZE,
+                JEB_PROFILER_COUNTER_SHARDS,
+                JEB_PROFILER_TRACK_SKETCH_SIZE});
         }
 
         void clear()
         {
-            profiles_.clear();
+            std::lock_guard lock(mutex_);
+            for (size_t i = 0; i < used_sections(); ++i)
+            {
+                sections_[i].data.take();
+                sections_[i].data.take_samples();
+                sections_[i].data.slowest_calls().take();
+                if (placements_)
+                    placements_[i].collect(true);
+            }
+            for (auto* site : counters_.sites())
+                site->reset();
+            for (auto* site : gauges_.sites())
+                site->reset();
+            for (auto* site : tracks_.sites())
+                site->reset();
+            for (size_t i = 0; i < used_locks(); ++i)
+                locks_[i].stats.take();
+            for (auto* section : report_sections_.sites())
+                section->clear();
+        }
+
+        internal::SiteList<CounterSite>& counters()
+        {
+            return counters_;
+        }
+
+        internal::SiteList<GaugeSite>& gauges()
+        {
+            return gauges_;
+        }
+
+        internal::SiteList<TrackSite>& tracks()
+        {
+            return tracks_;
+        }
+
+        /**
+         * @brief Adds a section that is written at the end of the report.
+         *
+         * @a section must remain valid for the lifetime of the profiler.
+         */
+        void add_report_section(ProfilerReportSection& section)
+        {
+            report_sections_.add(&section);
+        }
+
+        /**
+         * @brief Makes @a observer receive all existing and future
+         *  sections. Only one observer is supported, nullptr removes it.
+         *
+         * @a observer must remain valid until it has been removed.
+         */
+        void set_section_observer(ProfilerSectionObserver* observer)
+        {
+            std::lock_guard lock(mutex_);
+            observer_ = observer;
+            if (!observer_)
+                return;
+            for (size_t i = 0; i < used_sections(); ++i)
+                observer_->section_added(sections_[i].section, sections_[i].data);
+        }
+
+        /**
+         * @brief Makes every timed call record the CPU it starts and
+         *  ends on.
+         *
+         * The report then shows how the calls of each section are
+         * distributed over CPUs and NUMA nodes, and how many of them
+         * migrated to another CPU or node. Costs two calls to
+         * sched_getcpu per timed call, and one counter per CPU for each
+         * section.
+         *
+         * @return false if the CPU of the calling thread can't be
+         *  determined on this platform.
+         */
+        bool enable_cpu_tracking()
+        {
+            if (CpuTopology::current_cpu() < 0)
+                return false;
+            std::lock_guard lock(mutex_);
+            if (!placements_)
+            {
+                topology_.reset(new CpuTopology);
+                placements_.reset(new SectionPlacement[JEB_PROFILER_MAX_SECTIONS + 1]);
+                for (size_t i = 0; i <= JEB_PROFILER_MAX_SECTIONS; ++i)
+                {
+                    placements_[i].init(*topology_);
+                    sections_[i].data.set_placement(&placements_[i]);
+                }
+            }
+            track_cpus_.store(true, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Stops recording CPUs. The placement that has been
+         *  recorded so far remains in the report.
+         */
+        void disable_cpu_tracking()
+        {
+            track_cpus_.store(false, std::memory_order_release);
+        }
+
+        /**
+         * @brief Returns the accumulator for the given section, creating
+         *  it if necessary.
+         *
+         * The returned reference remains valid for the lifetime of the
+         * profiler, JEB_PROFILE() therefore only calls this function the
+         * first time it is executed. When the section table is full, all
+         * new sections share a single overflow section.
+         */
+        ProfilerAccumulator& section(std::string_view file_name,
+                                     std::string_view func_name,
+                                     size_t line_no,
+                                     ProfilerName name = {})
+        {
+            std::lock_guard lock(mutex_);
+            for (size_t i = 0; i < section_count_; ++i)
+            {
+                const auto& key = sections_[i].section;
+                if (key.line_no == line_no && sections_[i].name == name.id()
+                    && key.func_name == func_name
+                    && key.file_name == file_name)
+                {
+                    return sections_[i].data;
+                }
+            }
+
+            if (section_count_ == JEB_PROFILER_MAX_SECTIONS)
+            {
+                auto& entry = sections_[JEB_PROFILER_MAX_SECTIONS];
+                if (section_overflows_++ == 0)
+                    section_added(JEB_PROFILER_MAX_SECTIONS);
+                return entry.data;
+            }
+
+            auto& entry = sections_[section_count_++];
+            entry.section = ProfilerSection(file_name, func_name, line_no);
+            entry.section.name = names_.get(name.id());
+            entry.name = name.id();
+            section_added(section_count_ - 1);
+            return entry.data;
+        }
+
+        ProfilerAccumulator& section(std::string_view file_name,
+                                     std::string_view func_name,
+                                     size_t line_no,
+                                     std::string_view name)
+        {
+            return section(file_name, func_name, line_no, this->name(name));
+        }
+
+        /**
+         * @brief Returns the id of the given section name, adding it to
+         *  the name table if necessary.
+         *
+         * Looking up a name that is already known does not take any locks,
+         * but hashes and compares the string. Hot code with runtime names
+         * should look up its names in advance and use the returned id.
+         */
+        ProfilerName name(std::string_view name)
+        {
+            return ProfilerName(names_.intern(name));
+        }
+
+        [[nodiscard]] std::string_view name(ProfilerName name) const
+        {
+            return names_.get(name.id());
+        }
+
+        /**
+         * @brief Returns the statistics shared by all ProfiledMutexes
+         *  with the given name.
+         *
+         * The lock table is allocated the first time this function is
+         * called.
+         */
+        LockStats& lock_stats(std::string_view name)
+        {
+            auto id = names_.intern(name);
+            std::lock_guard lock(mutex_);
+            if (!locks_)
+                locks_.reset(new LockEntry[JEB_PROFILER_MAX_LOCKS + 1]);
+            for (size_t i = 0; i < lock_count_; ++i)
+            {
+                if (locks_[i].name == id)
+                    return locks_[i].stats;
+            }
+
+            if (lock_count_ == JEB_PROFILER_MAX_LOCKS)
+            {
+                ++lock_overflows_;
+                locks_[JEB_PROFILER_MAX_LOCKS].name = names_.intern("[overflow]");
+                return locks_[JEB_PROFILER_MAX_LOCKS].stats;
+            }
+
+            auto& entry = locks_[lock_count_++];
+            entry.name = id;
+            return entry.stats;
+        }
+
+        void start_timer(ProfilerAccumulator& section)
+        {
+            auto& stack = call_stack();
+            auto size = stack.size.load(std::memory_order_relaxed);
+            if (size == stack.entries.size())
+            {
+                ++stack.overflow;
+                depth_overflows_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto& entry = stack.entries[size];
+            entry.section = &section;
+            entry.sub_duration = Duration();
+            entry.tag.clear();
+            entry.bytes = 0;
+            entry.items = 0;
+            entry.cpu = track_cpus_.load(std::memory_order_acquire)
+                        ? CpuTopology::current_cpu() : -1;
+            // The entry must be complete before a signal handler on this
+            // thread can see it, see sample_current_thread.
+            std::atomic_signal_fence(std::memory_order_release);
+            stack.size.store(size + 1, std::memory_order_relaxed);
+            entry.start_time = Clock::now();
+            if (FlightRecorder::is_enabled())
+                FlightRecorder::instance().record_enter(&section, entry.start_time);
         }
 
         void start_timer(std::string_view file_name,
                          std::string_view func_name,
                          size_t line_no)
         {
-            call_stack_.emplace_back(
-                ProfilerSection(file_name, func_name, line_no),
-                Clock::now(),
-                Duration());
+            start_timer(section(file_name, func_name, line_no));
         }
 
         void end_timer()
         {
             auto end_time = Clock::now();
-            auto& [key, start_time, sub_duration] = call_stack_.back();
+            auto& stack = call_stack();
+            if (stack.overflow != 0)
+            {
+                --stack.overflow;
+                return;
+            }
+            auto size = stack.size.load(std::memory_order_relaxed);
+            if (size == 0)
+                return;
+            auto& [section, start_time, sub_duration, tag, bytes, items, cpu]
+                = stack.entries[size - 1];
+            if (FlightRecorder::is_enabled())
+                FlightRecorder::instance().record_exit(section, end_time);
             auto elapsed = end_time - start_time;
-            auto it = profiles_.find(key);
-            if (it == profiles_.end())
+            section->add_time(elapsed, elapsed - sub_duration);
+            if (bytes != 0 || items != 0)
+                section->add_work(bytes, items);
+            if (cpu >= 0)
+                section->add_placement(cpu, CpuTopology::current_cpu());
+            auto& slowest_calls = section->slowest_calls();
+            if (slowest_calls.is_candidate(elapsed))
             {
-                it = profiles_.emplace(key, ProfilerData()).first;
-                sequence_.push_back(it);
+                slowest_calls.add({elapsed, start_time,
+                                   std::this_thread::get_id(),
+                                   tag});
             }
-            it->second.add_time(elapsed, elapsed - sub_duration);
-            call_stack_.pop_back();
-            if (!call_stack_.empty())
-                std::get<2>(call_stack_.back()) += elapsed;
+            stack.size.store(--size, std::memory_order_relaxed);
+            if (size != 0)
+                stack.entries[size - 1].sub_duration += elapsed;
+        }
+
+        /**
+         * @brief Attaches a tag to the innermost active section on the
+         *  calling thread.
+         *
+         * The tag is shown next to the call if it becomes one of the
+         * slowest invocations of the section.
+         */
+        template <typename T>
+        void set_tag(const T& tag)
+        {
+            auto& stack = call_stack();
+            auto size = stack.size.load(std::memory_order_relaxed);
+            if (stack.overflow == 0 && size != 0)
+                stack.entries[size - 1].tag.set(tag);
+        }
+
+        /**
+         * @brief Adds to the amount of work done by the innermost active
+         *  section on the calling thread.
+         *
+         * The work is shown as throughput in the report.
+         */
+        void add_work(uint64_t bytes, uint64_t items)
+        {
+            auto& stack = call_stack();
+            auto size = stack.size.load(std::memory_order_relaxed);
+            if (stack.overflow == 0 && size != 0)
+            {
+                stack.entries[size - 1].bytes += bytes;
+                stack.entries[size - 1].items += items;
+            }
+        }
+
+        /**
+         * @brief Returns the number of active timers on the calling
+         *  thread.
+         */
+        [[nodiscard]] static size_t call_depth()
+        {
+            auto& stack = call_stack();
+            return stack.size.load(std::memory_order_relaxed) + stack.overflow;
+        }
+
+        /**
+         * @brief Adds a sample to the innermost active section on the
+         *  calling thread.
+         *
+         * This function is async-signal-safe and intended to be called
+         * from the signal handler of a sampling profiler. Call
+         * call_depth() on each thread before enabling any signals that
+         * call this function to ensure that the thread's call stack has
+         * been allocated.
+         *
+         * @return false if there is no active section.
+         */
+        static bool sample_current_thread()
+        {
+            auto& stack = call_stack();
+            auto size = stack.size.load(std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_acquire);
+            if (size == 0)
+                return false;
+            stack.entries[size - 1].section->add_sample();
+            return true;
         }
 
         void write(std::ostream& os) const
+        {
+            std::vector<Row> rows;
+            {
+                std::lock_guard lock(mutex_);
+                for (size_t i = 0; i < used_sections(); ++i)
+                {
+                    auto& [section, name, data] = sections_[i];
+                    rows.push_back({&section, data.snapshot(),
+                                    data.slowest_calls().snapshot(),
+                                    data.samples()});
+                }
+            }
+            write_report(os, rows);
+            write_throughput(os, rows);
+            write_slowest_calls(os, rows);
+            write_counters(os, false);
+            write_gauges(os);
+            write_tracks(os, false);
+            write_locks(os, false);
+            write_placement(os, false);
+            write_samples(os, rows);
+            for (auto* section : report_sections_.sites())
+                section->write(os, false);
+            write_overflows(os);
+            os.flush();
+        }
+
+        void write() const
+        {
+            write(std::cout);
+        }
+
+        void write(const std::string& filePath) const
+        {
+            std::ofstream file(filePath);
+            write(file);
+        }
+
+        /**
+         * @brief Writes the report and resets all timings, counters and
+         *  gauges.
+         *
+         * Timings and counts that are recorded while the report is being
+         * written are never lost, they are included in either this
+         * report or the next one.
+         */
+        void write_and_clear(std::ostream& os)
+        {
+            std::vector<Row> rows;
+            {
+                std::lock_guard lock(mutex_);
+                for (size_t i = 0; i < used_sections(); ++i)
+                {
+                    auto& [section, name, data] = sections_[i];
+                    rows.push_back({&section, data.take(),
+                                    data.slowest_calls().take(),
+                                    data.take_samples()});
+                }
+            }
+            write_report(os, rows);
+            write_throughput(os, rows);
+            write_slowest_calls(os, rows);
+            write_counters(os, true);
+            write_gauges(os);
+            write_tracks(os, true);
+            write_locks(os, true);
+            write_placement(os, true);
+            write_samples(os, rows);
+            for (auto* section : report_sections_.sites())
+                section->write(os, true);
+            write_overflows(os);
+            for (auto* site : gauges_.sites())
+                site->reset();
+            os.flush();
+        }
+    private:
+        struct Row
+        {
+            const ProfilerSection* section;
+            ProfilerData data;
+            std::vector<ProfilerCall> slowest_calls;
+            size_t samples;
+        };
+
+        Profiler()
+            : sections_(new SectionEntry[JEB_PROFILER_MAX_SECTIONS + 1])
+        {
+            sections_[JEB_PROFILER_MAX_SECTIONS].section.func_name = "[overflow]";
+            FlightRecorder::instance().set_key_writer(write_section_key);
+        }
+
+        /**
+         * @brief Writes the function name, section name and location of
+         *  the section whose ProfilerAccumulator is at @a key.
+         *
+         * Used by the flight recorder, and therefore async-signal-safe.
+         */
+        static void write_section_key(const void* key, FlightRecorderWriter& out)
+        {
+            // The key writer is set by the constructor, so instance() has
+            // already been initialized.
+            const auto& profiler = instance();
+            auto* first = reinterpret_cast<const char*>(&profiler.sections_[0].data);
+            auto offset = reinterpret_cast<const char*>(key) - first;
+            auto index = size_t(offset) / sizeof(SectionEntry);
+            if (offset < 0 || index > JEB_PROFILER_MAX_SECTIONS
+                || &profiler.sections_[index].data != key)
+            {
+                out << "[unknown]";
+                return;
+            }
+
+            const auto& section = profiler.sections_[index].section;
+            out << section.func_name;
+            if (!section.name.empty())
+                out << " [" << section.name << "]";
+            if (!section.file_name.empty())
+            {
+                out << "  " << section.file_name
+                    #ifdef _MSC_VER
+                    << "(" << uint64_t(section.line_no) << ")";
+                    #else
+                    << ":" << uint64_t(section.line_no);
+                    #endif
+            }
+        }
+
+        /**
+         * @brief Notifies the observer about the section at @a index in
+         *  sections_.
+         *
+         * The caller must hold mutex_.
+         */
+        void section_added(size_t index)
+        {
+            if (observer_)
+                observer_->section_added(sections_[index].section,
+                                         sections_[index].data);
+        }
+
+        /**
+         * @brief Returns the number of entries in sections_ that are in
+         *  use, including the overflow entry if it has been used.
+         *
+         * The caller must hold mutex_.
+         */
+        [[nodiscard]] size_t used_sections() const
+        {
+            return section_overflows_ == 0 ? section_count_
+                                            : JEB_PROFILER_MAX_SECTIONS + 1;
+        }
+
+        /**
+         * @brief Returns the number of entries in locks_ that are in
+         *  use, including the overflow entry if it has been used.
+         *
+         * The caller must hold mutex_.
+         */
+        [[nodiscard]] size_t used_locks() const
+        {
+            return lock_overflows_ == 0 ? lock_count_
+                                        : JEB_PROFILER_MAX_LOCKS + 1;
+        }
+
+        void write_locks(std::ostream& os, bool reset) const
+        {
+            std::vector<std::pair<std::string_view, LockData>> rows;
+            {
+                std::lock_guard lock(mutex_);
+                for (size_t i = 0; i < used_locks(); ++i)
+                {
+                    auto& [name, stats] = locks_[i];
+                    rows.emplace_back(names_.get(name),
+                                      reset ? stats.take() : stats.snapshot());
+                }
+            }
+            if (rows.empty())
+                return;
+
+            using std::left, std::right, std::setw;
+            auto seconds = [](LockData::Duration d)
+            {
+                return std::chrono::duration<double>(d).count();
+            };
+
+            const int w = 11;
+            os << "\nlocks\n" << right
+               << setw(w) << "acquired" << " " << setw(w) << "contended"
+               << " " << setw(w) << "wait sum" << " " << setw(w) << "wait max"
+               << " " << setw(w) << "hold mean" << " " << setw(w) << "hold max"
+               << " " << setw(w) << "shared mean" << " " << setw(w) << "shared max"
+               << " " << setw(w) << "waiters" << "  name\n";
+            auto flags = os.flags();
+            auto precision = os.precision(4);
+            os << std::defaultfloat;
+            for (const auto& [name, data] : rows)
+            {
+                auto mean = [&](LockData::Duration time, size_t samples)
+                {
+                    return samples == 0 ? 0.0 : seconds(time) / double(samples);
+                };
+                os << setw(w) << data.acquisitions
+                   << " " << setw(w) << data.contended
+                   << " " << setw(w) << seconds(data.wait_time)
+                   << " " << setw(w) << seconds(data.max_wait_time)
+                   << " " << setw(w) << mean(data.hold_time, data.hold_samples)
+                   << " " << setw(w) << seconds(data.max_hold_time)
+                   << " " << setw(w) << mean(data.shared_hold_time,
+                                             data.shared_hold_samples)
+                   << " " << setw(w) << seconds(data.max_shared_hold_time)
+                   << " " << setw(w) << data.max_waiters
+                   << "  " << name << '\n';
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        void write_placement(std::ostream& os, bool reset) const
+        {
+            std::vector<std::pair<const ProfilerSection*, PlacementData>> rows;
+            {
+                std::lock_guard lock(mutex_);
+                if (!placements_)
+                    return;
+                for (size_t i = 0; i < used_sections(); ++i)
+                {
+                    auto data = placements_[i].collect(reset);
+                    if (data.calls != 0)
+                        rows.emplace_back(&sections_[i].section, std::move(data));
+                }
+            }
+            if (rows.empty())
+                return;
+
+            using std::left, std::right, std::setw;
+            auto percent = [](size_t n, size_t total)
+            {
+                return total != 0 ? 100.0 * double(n) / double(total) : 0.0;
+            };
+            auto write_distribution = [&](const char* title,
+                                          const std::vector<size_t>& calls,
+                                          size_t total)
+            {
+                std::vector<std::pair<size_t, size_t>> sorted;
+                for (size_t i = 0; i < calls.size(); ++i)
+                {
+                    if (calls[i] != 0)
+                        sorted.emplace_back(calls[i], i);
+                }
+                std::sort(sorted.begin(), sorted.end(), std::greater<>());
+                os << setw(40) << "" << left << setw(5) << title << right;
+                for (size_t i = 0; i < sorted.size() && i < 6; ++i)
+                {
+                    os << " " << setw(3) << sorted[i].second << ":"
+                       << setw(5) << percent(sorted[i].first, total) << "%";
+                }
+                if (sorted.size() > 6)
+                    os << "  (" << sorted.size() - 6 << " more)";
+                os << '\n';
+            };
+
+            const int w = 12;
+            os << '\n' << right << setw(w) << "calls"
+               << " " << setw(w) << "migrated" << " " << setw(w) << "cross-node"
+               << "  cpu placement\n";
+            auto flags = os.flags();
+            auto precision = os.precision(1);
+            os << std::fixed;
+            for (const auto& [key, data] : rows)
+            {
+                os << setw(w) << data.calls
+                   << " " << setw(w - 1) << percent(data.migrations, data.calls) << "%"
+                   << " " << setw(w - 1) << percent(data.node_migrations, data.calls) << "%"
+                   << "  " << key->func_name;
+                if (!key->name.empty())
+                    os << " [" << key->name << "]";
+                os << "  ";
+                write_location(os, key->file_name, key->line_no);
+                os << '\n';
+                if (topology_->node_count() > 1)
+                {
+                    std::vector<size_t> node_calls(topology_->node_count());
+                    for (size_t cpu = 0; cpu < data.cpu_calls.size(); ++cpu)
+                        node_calls[topology_->node(cpu)] += data.cpu_calls[cpu];
+                    write_distribution("nodes", node_calls, data.calls);
+                }
+                write_distribution("cpus", data.cpu_calls, data.calls);
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        static void write_samples(std::ostream& os,
+                                  const std::vector<Row>& rows)
+        {
+            size_t total = 0;
+            for (const auto& row : rows)
+                total += row.samples;
+            if (total == 0)
+                return;
+
+            std::vector<const Row*> sorted;
+            for (const auto& row : rows)
+            {
+                if (row.samples != 0)
+                    sorted.push_back(&row);
+            }
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](auto* a, auto* b) {return a->samples > b->samples;});
+
+            using std::left, std::right, std::setw;
+            auto flags = os.flags();
+            auto precision = os.precision(1);
+            os << std::fixed << '\n' << right << setw(10) << "samples"
+               << setw(8) << "%" << "  sampled sections\n";
+            for (const auto* row : sorted)
+            {
+                os << setw(10) << row->samples
+                   << setw(8) << 100.0 * double(row->samples) / double(total)
+                   << "  " << row->section->func_name;
+                if (!row->section->name.empty())
+                    os << " [" << row->section->name << "]";
+                os << "  ";
+                write_location(os, row->section->file_name,
+                               row->section->line_no);
+                os << '\n';
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        void write_overflows(std::ostream& os) const
+        {
+            size_t section_overflows;
+            size_t lock_overflows;
+            {
+                std::lock_guard lock(mutex_);
+                section_overflows = section_overflows_;
+                lock_overflows = lock_overflows_;
+            }
+            auto depth_overflows = depth_overflows_.load(
+                std::memory_order_relaxed);
+            if (section_overflows != 0)
+            {
+                os << '\n' << section_overflows << " section(s) did not fit"
+                   " in JEB_PROFILER_MAX_SECTIONS ("
+                   << JEB_PROFILER_MAX_SECTIONS << ").\n";
+            }
+            if (auto name_overflows = names_.overflows(); name_overflows != 0)
+            {
+                os << '\n' << name_overflows << " section name(s) did not fit"
+                   " in JEB_PROFILER_MAX_NAMES (" << JEB_PROFILER_MAX_NAMES
+                   << ") or JEB_PROFILER_NAME_BUFFER_SIZE ("
+                   << JEB_PROFILER_NAME_BUFFER_SIZE << ").\n";
+            }
+            if (lock_overflows != 0)
+            {
+                os << '\n' << lock_overflows << " lock name(s) did not fit"
+                   " in JEB_PROFILER_MAX_LOCKS (" << JEB_PROFILER_MAX_LOCKS
+                   << ").\n";
+            }
+            if (depth_overflows != 0)
+            {
+                os << '\n' << depth_overflows << " call(s) were not timed"
+                   " because they exceeded JEB_PROFILER_MAX_DEPTH ("
+                   << JEB_PROFILER_MAX_DEPTH << ").\n";
+            }
+        }
+
+        static void write_report(std::ostream& os, std::vector<Row>& rows)
         {
             auto int_width = [](auto n)
             {
                 if (n == 0)
                     return 1;
                 if (n < 0)
-                    return int(std::ceil(std::log10(-n)) + 1);
-                return int(std::ceil(std::log10(n)));
+                    return int(std::floor(std::log10(-n)) + 2);
+                return int(std::floor(std::log10(n)) + 1);
             };
 
             auto float_width = [](auto n)
@@ -161,98 +1370,642 @@ namespace JEBDebug
                 return int(std::ceil(std::log10(n))) + 5;
             };
 
-            int widths[5] = {5, 3, 3, 3, 8};
-            for (const auto& it : sequence_)
+            rows.erase(std::remove_if(rows.begin(), rows.end(),
+                                      [](auto& r)
+                                      {
+                                          return r.data.count() == 0
+                                                 && r.samples == 0;
+                                      }),
+                       rows.end());
+            if (rows.empty())
+                return;
+
+            int widths[6] = {5, 3, 3, 3, 8, 0};
+            for (const auto& [key, data, slowest, samples] : rows)
             {
-                widths[0] = std::max(widths[0], int_width(it->second.count()));
-                widths[1] = std::max(widths[1], float_width(it->second.acc_time()));
-                widths[2] = std::max(widths[2], float_width(it->second.min_time()));
-                widths[3] = std::max(widths[3], float_width(it->second.max_time()));
-                widths[4] = std::max(widths[4], int(it->first.func_name.size()));
+                widths[0] = std::max(widths[0], int_width(data.count()));
+                widths[1] = std::max(widths[1], float_width(data.acc_time()));
+                // Sections that have only been sampled have no min or max.
+                if (data.count() != 0)
+                {
+                    widths[2] = std::max(widths[2], float_width(data.min_time()));
+                    widths[3] = std::max(widths[3], float_width(data.max_time()));
+                }
+                widths[4] = std::max(widths[4], int(key->func_name.size()));
+                widths[5] = std::max(widths[5], int(key->name.size()));
             }
+            // Only show the name column if at least one section has a name.
+            if (widths[5] != 0)
+                widths[5] = std::max(widths[5], 4);
+
             using std::left, std::right, std::setw;
             os << right << setw(widths[0]) << "calls"
                << " " << setw(widths[1]) << "sum"
                << " " << setw(widths[2]) << "min"
                << " " << setw(widths[3]) << "max"
-               << left << "  " << setw(widths[4]) << "function"
+               << left << "  " << setw(widths[4]) << "function";
+            if (widths[5] != 0)
+                os << "  " << setw(widths[5]) << "name";
+            os << "  file\n";
+
+            auto flags = os.flags();
+            auto precision = os.precision(4);
+            os << std::fixed;
+            for (const auto& [key, data, slowest, samples] : rows)
+            {
+                os << right << setw(widths[0]) << data.count()
+                   << " " << setw(widths[1]) << data.acc_time();
+                if (data.count() != 0)
+                {
+                    os << " " << setw(widths[2]) << data.min_time()
+                       << " " << setw(widths[3]) << data.max_time();
+                }
+                else
+                {
+                    os << " " << setw(widths[2]) << "-"
+                       << " " << setw(widths[3]) << "-";
+                }
+                os << "  " << left << setw(widths[4]) << key->func_name;
+                if (widths[5] != 0)
+                    os << "  " << setw(widths[5]) << key->name;
+                os << "  ";
+                write_location(os, key->file_name, key->line_no);
+                os << '\n';
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        static void write_throughput(std::ostream& os,
+                                     const std::vector<Row>& rows)
+        {
+            auto has_work = [](auto& r) {return r.data.has_work();};
+            if (std::none_of(rows.begin(), rows.end(), has_work))
+                return;
+
+            auto per_second = [](uint64_t n, double time)
+            {
+                return time > 0 ? double(n) / time : 0.0;
+            };
+            auto per_call = [](uint64_t n, size_t count)
+            {
+                return count != 0 ? double(n) / double(count) : 0.0;
+            };
+
+            using std::left, std::right, std::setw;
+            const int w = 12;
+            os << '\n' << right << setw(w) << "time"
+               << " " << setw(w) << "MB/s" << " " << setw(w) << "bytes/call"
+               << " " << setw(w) << "items/s" << " " << setw(w) << "items/call"
+               << "  throughput\n";
+            auto flags = os.flags();
+            auto precision = os.precision();
+            os << std::fixed;
+            for (const auto& [key, data, slowest, samples] : rows)
+            {
+                if (!data.has_work())
+                    continue;
+                auto time = data.total_time();
+                os << right << std::setprecision(4) << setw(w) << time
+                   << std::setprecision(1)
+                   << " " << setw(w) << per_second(data.bytes(), time) / 1e6
+                   << " " << setw(w) << per_call(data.bytes(), data.count())
+                   << " " << setw(w) << per_second(data.items(), time)
+                   << " " << setw(w) << per_call(data.items(), data.count())
+                   << "  " << key->func_name;
+                if (!key->name.empty())
+                    os << " [" << key->name << "]";
+                os << "  ";
+                write_location(os, key->file_name, key->line_no);
+                os << '\n';
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        void write_slowest_calls(std::ostream& os,
+                                 const std::vector<Row>& rows) const
+        {
+            auto has_calls = [](auto& r) {return !r.slowest_calls.empty();};
+            if (std::none_of(rows.begin(), rows.end(), has_calls))
+                return;
+
+            using std::left, std::right, std::setw;
+            auto flags = os.flags();
+            auto precision = os.precision(4);
+            os << std::fixed << "\n" << right << setw(12) << "time"
+               << setw(12) << "start" << "  slowest calls\n";
+            for (const auto& [key, data, slowest, samples] : rows)
+            {
+                if (slowest.empty())
+                    continue;
+                os << "  " << key->func_name;
+                if (!key->name.empty())
+                    os << " [" << key->name << "]";
+                os << "  ";
+                write_location(os, key->file_name, key->line_no);
+                os << '\n';
+                for (const auto& call : slowest)
+                {
+                    using namespace std::chrono;
+                    auto time = duration<double>(call.time).count();
+                    auto start = duration<double>(call.start_time
+                                                  - start_time_).count();
+                    os << right << setw(12) << time
+                       << setw(12) << start
+                       << "  thread " << call.thread_id;
+                    if (!call.tag.view().empty())
+                        os << "  tag " << call.tag.view();
+                    os << '\n';
+                }
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        void write_counters(std::ostream& os, bool reset) const
+        {
+            if (counters_.empty())
+                return;
+
+            auto sites = counters_.sites();
+            std::vector<int64_t> values;
+            int widths[2] = {5, 4};
+            for (auto* site : sites)
+            {
+                values.push_back(reset ? site->take() : site->value());
+                auto text = std::to_string(values.back());
+                widths[0] = std::max(widths[0], int(text.size()));
+                widths[1] = std::max(widths[1], int(site->name.size()));
+            }
+
+            using std::left, std::right, std::setw;
+            os << '\n' << right << setw(widths[0]) << "count"
+               << left << "  " << setw(widths[1]) << "name"
                << "  file\n";
+            for (size_t i = 0; i < sites.size(); ++i)
+            {
+                os << right << setw(widths[0]) << values[i]
+                   << "  " << left << setw(widths[1]) << sites[i]->name
+                   << "  ";
+                write_location(os, sites[i]->file_name, sites[i]->line_no);
+                os << '\n';
+            }
+        }
+
+        void write_gauges(std::ostream& os) const
+        {
+            if (gauges_.empty())
+                return;
 
-            os << std::setprecision(4) << std::fixed;
-            for (auto it : sequence_)
-            {
-                os << right << setw(widths[0]) << it->second.count()
-                   << " " << setw(widths[1]) << it->second.acc_time()
-                   << " " << setw(widths[2]) << it->second.min_time()
-                   << " " << setw(widths[3]) << it->second.max_time()
-                   << "  " << left << setw(widths[4]) << it->first.func_name
-                   << "  " << it->first.file_name
-                   #ifdef _MSC_VER
-                   << "(" << it->first.line_no << ")"
-                   #else
-                   << ":" << it->first.line_no
-                   #endif
-                   << '\n';
+            auto sites = gauges_.sites();
+            int name_width = 4;
+            for (const auto* site : sites)
+                name_width = std::max(name_width, int(site->name.size()));
+
+            using std::left, std::right, std::setw;
+            const int w = 12;
+            os << '\n' << right << setw(w) << "last"
+               << " " << setw(w) << "min"
+               << " " << setw(w) << "mean"
+               << " " << setw(w) << "max"
+               << " " << setw(w) << "updates"
+               << left << "  " << setw(name_width) << "name"
+               << "  file\n";
+            auto flags = os.flags();
+            os << std::defaultfloat << std::setprecision(6);
+            for (const auto* site : sites)
+            {
+                if (site->count() == 0)
+                {
+                    os << right << setw(w) << "-"
+                       << " " << setw(w) << "-"
+                       << " " << setw(w) << "-"
+                       << " " << setw(w) << "-";
+                }
+                else
+                {
+                    os << right << setw(w) << site->last()
+                       << " " << setw(w) << site->min()
+                       << " " << setw(w) << site->mean()
+                       << " " << setw(w) << site->max();
+                }
+                os << " " << setw(w) << site->count()
+                   << "  " << left << setw(name_width) << site->name
+                   << "  ";
+                write_location(os, site->file_name, site->line_no);
+                os << '\n';
             }
-            os.flush();
+            os.flags(flags);
         }
 
-        void write() const
+        void write_tracks(std::ostream& os, bool reset) const
         {
-            write(std::cout);
+            if (tracks_.empty())
+                return;
+
+            auto sites = tracks_.sites();
+            int name_width = 10;
+            for (const auto* site : sites)
+                name_width = std::max(name_width, int(site->name.size()));
+
+            using std::left, std::right, std::setw;
+            const int w = 12;
+            os << '\n' << right << setw(w) << "count"
+               << " " << setw(w) << "mean" << " " << setw(w) << "stddev"
+               << " " << setw(w) << "min" << " " << setw(w) << "p50"
+               << " " << setw(w) << "p90" << " " << setw(w) << "p99"
+               << " " << setw(w) << "max"
+               << left << "  " << setw(name_width) << "expression"
+               << "  file\n";
+            auto flags = os.flags();
+            auto precision = os.precision(6);
+            os << std::defaultfloat;
+            for (auto* site : sites)
+            {
+                RunningStats stats;
+                QuantileSketch sketch;
+                site->collect(stats, sketch, reset);
+                os << right << setw(w) << stats.count();
+                if (stats.count() == 0)
+                {
+                    for (int i = 0; i < 7; ++i)
+                        os << " " << setw(w) << "-";
+                }
+                else
+                {
+                    os << " " << setw(w) << stats.mean()
+                       << " " << setw(w) << stats.stddev()
+                       << " " << setw(w) << stats.min()
+                       << " " << setw(w) << sketch.quantile(0.5)
+                       << " " << setw(w) << sketch.quantile(0.9)
+                       << " " << setw(w) << sketch.quantile(0.99)
+                       << " " << setw(w) << stats.max();
+                }
+                os << "  " << left << setw(name_width) << site->name << "  ";
+                write_location(os, site->file_name, site->line_no);
+                os << '\n';
+            }
+            os.precision(precision);
+            os.flags(flags);
         }
 
-        void write(const std::string& filePath) const
+        static void write_location(std::ostream& os,
+                                   std::string_view file_name,
+                                   size_t line_no)
         {
-            std::ofstream file(filePath);
-            write(file);
+            if (file_name.empty())
+                return;
+            os << file_name
+               #ifdef _MSC_VER
+               << "(" << line_no << ")";
+               #else
+               << ":" << line_no;
+               #endif
         }
-    private:
-        Profiler() = default;
 
         static Profiler instance_;
 
         using Clock = std::chrono::high_resolution_clock;
         using TimePoint = Clock::time_point;
         using Duration = Clock::duration;
-        std::vector<std::tuple<ProfilerSection, TimePoint, Duration>> call_stack_;
 
-        using ProfileSectionLookup = std::map<ProfilerSection, ProfilerData>;
-        ProfileSectionLookup profiles_;
+        struct CallStackEntry
+        {
+            ProfilerAccumulator* section = nullptr;
+            TimePoint start_time;
+            Duration sub_duration;
+            ProfilerTag tag;
+            uint64_t bytes = 0;
+            uint64_t items = 0;
+            /// The CPU the call started on, or -1 if CPU tracking is
+            /// disabled.
+            int cpu = -1;
+        };
+
+        struct CallStack
+        {
+            std::array<CallStackEntry, JEB_PROFILER_MAX_DEPTH> entries;
+            std::atomic<size_t> size = 0;
+            /// The number of active timers that did not fit in entries.
+            size_t overflow = 0;
+        };
+
+        static CallStack& call_stack()
+        {
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+            return *static_cast<CallStack*>(
+                jeb_internal_call_stack(config_hash()));
+#else
+            thread_local CallStack stack;
+            return stack;
+#endif
+        }
+
+        friend void* ::jeb_internal_call_stack(uint64_t);
+
+        struct SectionEntry
+        {
+            ProfilerSection section;
+            StringTable::Id name = 0;
+            ProfilerAccumulator data;
+        };
+
+        TimePoint start_time_ = Clock::now();
+
+        mutable std::mutex mutex_;
+
+        /// JEB_PROFILER_MAX_SECTIONS entries followed by the overflow entry.
+        std::unique_ptr<SectionEntry[]> sections_;
+        size_t section_count_ = 0;
+        size_t section_overflows_ = 0;
+        std::atomic<size_t> depth_overflows_ = 0;
+
+        struct LockEntry
+        {
+            StringTable::Id name = 0;
+            LockStats stats;
+        };
+
+        /// JEB_PROFILER_MAX_LOCKS entries followed by the overflow entry.
+        std::unique_ptr<LockEntry[]> locks_;
+        size_t lock_count_ = 0;
+        size_t lock_overflows_ = 0;
+
+        internal::SiteList<ProfilerReportSection> report_sections_;
+        ProfilerSectionObserver* observer_ = nullptr;
 
-        std::vector<ProfileSectionLookup::const_iterator> sequence_;
+        std::atomic<bool> track_cpus_ = false;
+        std::unique_ptr<CpuTopology> topology_;
+        /// Parallel to sections_, allocated by enable_cpu_tracking.
+        std::unique_ptr<SectionPlacement[]> placements_;
+
+        StringTable names_{JEB_PROFILER_MAX_NAMES,
+                           JEB_PROFILER_NAME_BUFFER_SIZE};
+
+        internal::SiteList<CounterSite> counters_;
+        internal::SiteList<GaugeSite> gauges_;
+        internal::SiteList<TrackSite> tracks_;
     };
 
-#ifdef JEB_INSTANTIATE_PROFILER
+#if defined(JEB_INSTANTIATE_PROFILER) && !defined(INTERNAL_JEB_PROFILER_FROM_RUNTIME) \
+    && !defined(JEB_PROFILER_BUILDING_RUNTIME)
     Profiler Profiler::instance_;
 #endif
 
+    /**
+     * @brief Times a section from its construction to its destruction.
+     *
+     * With JEB_PROFILER_USE_RUNTIME, the timer is started and stopped
+     * by the runtime's jeb_scope_enter and jeb_scope_exit.
+     */
     class ProfilerTimer
     {
     public:
+        explicit ProfilerTimer(ProfilerAccumulator& section)
+        {
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+            // jeb_section handles are pointers to ProfilerAccumulators.
+            jeb_scope_enter(reinterpret_cast<jeb_section*>(&section));
+#else
+            Profiler::instance().start_timer(section);
+#endif
+        }
+
         ProfilerTimer(std::string_view file_name,
                       std::string_view func_name,
                       size_t line_no)
-        {
-            Profiler::instance().start_timer(file_name, func_name, line_no);
-        }
+            : ProfilerTimer(Profiler::instance().section(file_name, func_name,
+                                                         line_no))
+        {}
+
+        ProfilerTimer(const ProfilerTimer&) = delete;
+
+        ProfilerTimer& operator=(const ProfilerTimer&) = delete;
 
         ~ProfilerTimer()
         {
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+            jeb_scope_exit();
+#else
             Profiler::instance().end_timer();
+#endif
+        }
+
+        /**
+         * @brief Adds to the amount of work done by this timer's section.
+         *
+         * The timer must be the innermost active timer on the calling
+         * thread.
+         */
+        void add_work(uint64_t bytes, uint64_t items = 0)
+        {
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+            jeb_scope_add_work(bytes, items);
+#else
+            Profiler::instance().add_work(bytes, items);
+#endif
         }
     };
+
+    /**
+     * @brief A call site whose section is chosen at runtime by name.
+     *
+     * The sections for the first JEB_PROFILER_MAX_NAMES_PER_SITE names
+     * are cached in a small lock-free hash table keyed on the name id.
+     */
+    class DynamicProfilerSection
+    {
+    public:
+        DynamicProfilerSection(std::string_view file_name,
+                               std::string_view func_name,
+                               size_t line_no)
+            : file_name_(file_name),
+              func_name_(func_name),
+              line_no_(line_no)
+        {}
+
+        ProfilerAccumulator& section(ProfilerName name)
+        {
+            auto key = name.id() + 1;
+            for (size_t i = 0; i < SIZE; ++i)
+            {
+                auto& slot = slots_[(key + i) % SIZE];
+                auto slot_key = slot.key.load(std::memory_order_acquire);
+                if (slot_key == key)
+                    return *slot.section.load(std::memory_order_relaxed);
+                if (slot_key == 0)
+                    break;
+            }
+            return add_section(name);
+        }
+
+        ProfilerAccumulator& section(std::string_view name)
+        {
+            return section(Profiler::instance().name(name));
+        }
+    private:
+        ProfilerAccumulator& add_section(ProfilerName name)
+        {
+            auto& section = Profiler::instance().section(
+                file_name_, func_name_, line_no_, name);
+
+            std::lock_guard lock(mutex_);
+            auto key = name.id() + 1;
+            for (size_t i = 0; i < SIZE; ++i)
+            {
+                auto& slot = slots_[(key + i) % SIZE];
+                auto slot_key = slot.key.load(std::memory_order_relaxed);
+                if (slot_key == key)
+                    break;
+                if (slot_key == 0)
+                {
+                    slot.section.store(&section, std::memory_order_relaxed);
+                    slot.key.store(key, std::memory_order_release);
+                    break;
+                }
+            }
+            return section;
+        }
+
+        static constexpr size_t SIZE = JEB_PROFILER_MAX_NAMES_PER_SITE;
+
+        struct Slot
+        {
+            std::atomic<StringTable::Id> key = 0;
+            std::atomic<ProfilerAccumulator*> section = nullptr;
+        };
+
+        std::string_view file_name_;
+        std::string_view func_name_;
+        size_t line_no_;
+        std::array<Slot, SIZE> slots_;
+        std::mutex mutex_;
+    };
+INTERNAL_JEB_PROFILER_END_RUNTIME_NAMESPACE
 }
 
+// Replace the basic macros from ProfilerRuntime.hpp.
+#ifdef INTERNAL_JEB_PROFILER_RUNTIME_MACROS
+    #undef JEB_PROFILE
+    #undef JEB_PROFILE_NAMED
+    #undef JEB_PROFILE_WORK
+    #undef JEB_PROFILER_REPORT
+    #undef INTERNAL_JEB_PROFILER_RUNTIME_MACROS
+#endif
+
 #define INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER2(name, lineno) name##_##lineno
 #define INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER1(name, lineno) \
     INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER2(name, lineno)
 #define INTERNAL_JEB_PROFILER_UNIQUE_NAME(name) \
     INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER1(name, __LINE__)
 
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+
+// Registers and times the section through the runtime's C interface.
+#define JEB_PROFILE() \
+    static ::jeb_section* const \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section) = \
+            ::jeb_section_register(__FILE__, __func__, __LINE__, nullptr); \
+    ::JEBDebug::RuntimeProfilerTimer INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile) \
+        (INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section))
+
+#else
+
 #define JEB_PROFILE() \
+    static ::JEBDebug::ProfilerAccumulator& \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section) = \
+            ::JEBDebug::Profiler::instance().section( \
+                __FILE__, __func__, __LINE__); \
     ::JEBDebug::ProfilerTimer INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile) \
-        (__FILE__, __func__, __LINE__)
+        (INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section))
+
+#endif
+
+/**
+ * @brief Profiles the rest of the current scope as a section with the given
+ *  name.
+ *
+ * Useful for telling apart several sections in the same function. The name
+ * is looked up once.
+ */
+#define JEB_PROFILE_NAMED(name) \
+    static ::JEBDebug::ProfilerAccumulator& \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section) = \
+            ::JEBDebug::Profiler::instance().section( \
+                __FILE__, __func__, __LINE__, name); \
+    ::JEBDebug::ProfilerTimer INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile) \
+        (INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section))
+
+/**
+ * @brief Profiles the rest of the current scope as a section whose name
+ *  is only known at runtime.
+ *
+ * @a name is either a string or a ProfilerName returned by
+ * JEB_PROFILER_NAME. Strings must be hashed and compared each time, while
+ * ProfilerNames are plain integers.
+ */
+#define JEB_PROFILE_DYNAMIC(name) \
+    static ::JEBDebug::DynamicProfilerSection \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_site) \
+            (__FILE__, __func__, __LINE__); \
+    ::JEBDebug::ProfilerTimer INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile) \
+        (INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_site).section(name))
+
+#define JEB_PROFILER_NAME(text) \
+    ::JEBDebug::Profiler::instance().name(std::string_view(text))
+
+#define JEB_PROFILE_TAG(tag) \
+    ::JEBDebug::Profiler::instance().set_tag(tag)
+
+/**
+ * @brief Adds @a bytes and @a items to the work done by the innermost
+ *  active section on the current thread.
+ *
+ * Sections that report work get a throughput table in the report.
+ */
+#ifdef INTERNAL_JEB_PROFILER_FROM_RUNTIME
+    #define JEB_PROFILE_WORK(bytes, items) \
+        ::jeb_scope_add_work(bytes, items)
+#else
+    #define JEB_PROFILE_WORK(bytes, items) \
+        ::JEBDebug::Profiler::instance().add_work(bytes, items)
+#endif
 
 #define JEB_PROFILER_REPORT() \
     ::JEBDebug::Profiler::instance().write()
+
+#define JEB_COUNT(name, delta) \
+    do { \
+        static ::JEBDebug::CounterSite INTERNAL_JEB_PROFILER_UNIQUE_NAME(counter) \
+            (name, __FILE__, __LINE__, \
+             ::JEBDebug::Profiler::instance().counters()); \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(counter).add(delta); \
+    } while (false)
+
+#define JEB_GAUGE(name, value) \
+    do { \
+        static ::JEBDebug::GaugeSite INTERNAL_JEB_PROFILER_UNIQUE_NAME(gauge) \
+            (name, __FILE__, __LINE__, \
+             ::JEBDebug::Profiler::instance().gauges()); \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(gauge).set(double(value)); \
+    } while (false)
+
+/**
+ * @brief Adds the value of @a expr to the distribution shown for this
+ *  call site in the profiler report.
+ *
+ * The report shows the count, mean, standard deviation, minimum, maximum
+ * and estimated percentiles of the values. Each thread records its
+ * values in its own storage.
+ */
+#define JEB_TRACK(expr) \
+    do { \
+        static ::JEBDebug::TrackSite INTERNAL_JEB_PROFILER_UNIQUE_NAME(track) \
+            (#expr, __FILE__, __LINE__, \
+             ::JEBDebug::Profiler::instance().tracks()); \
+        thread_local ::JEBDebug::TrackShardOwner \
+            INTERNAL_JEB_PROFILER_UNIQUE_NAME(track_shard); \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(track).add( \
+            INTERNAL_JEB_PROFILER_UNIQUE_NAME(track_shard), double(expr)); \
+    } while (false)
@@ -0,0 +1,327 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#ifndef JEB_PROFILER_COUNTER_SHARDS
+    #define JEB_PROFILER_COUNTER_SHARDS 16
+#endif
+
+namespace JEBDebug
+{
+    namespace internal
+    {
+        constexpr size_t CACHE_LINE_SIZE = 64;
+
+        /**
+         * @brief Returns the shard used by the calling thread.
+         *
+         * Threads are assigned shards round-robin the first time they
+         * update a counter or gauge.
+         */
+        inline size_t counter_shard_index()
+        {
+            static std::atomic<size_t> next_index(0);
+            thread_local size_t index = next_index.fetch_add(
+                1, std::memory_order_relaxed) % JEB_PROFILER_COUNTER_SHARDS;
+            return index;
+        }
+
+        template <typename T>
+        void atomic_add(std::atomic<T>& sum, T value)
+        {
+            auto old_value = sum.load(std::memory_order_relaxed);
+            while (!sum.compare_exchange_weak(old_value, old_value + value,
+                                              std::memory_order_relaxed))
+            {}
+        }
+
+        template <typename T>
+        void atomic_min(std::atomic<T>& min, T value)
+        {
+            auto old_value = min.load(std::memory_order_relaxed);
+            while (value < old_value
+                   && !min.compare_exchange_weak(old_value, value,
+                                                 std::memory_order_relaxed))
+            {}
+        }
+
+        template <typename T>
+        void atomic_max(std::atomic<T>& max, T value)
+        {
+            auto old_value = max.load(std::memory_order_relaxed);
+            while (value > old_value
+                   && !max.compare_exchange_weak(old_value, value,
+                                                 std::memory_order_relaxed))
+            {}
+        }
+
+        /**
+         * @brief A counter split across cache-line aligned shards so
+         *  that threads incrementing it do not contend.
+         */
+        class ShardedCounter
+        {
+        public:
+            void add(int64_t delta)
+            {
+                shards_[counter_shard_index()].value.fetch_add(
+                    delta, std::memory_order_relaxed);
+            }
+
+            [[nodiscard]] int64_t value() const
+            {
+                int64_t result = 0;
+                for (const auto& shard : shards_)
+                    result += shard.value.load(std::memory_order_relaxed);
+                return result;
+            }
+
+            /**
+             * @brief Returns the current value and sets the counter to zero.
+             *
+             * Increments made while the shards are being collected are
+             * either included in the result or kept for the next call.
+             */
+            int64_t take()
+            {
+                int64_t result = 0;
+                for (auto& shard : shards_)
+                    result += shard.value.exchange(0, std::memory_order_relaxed);
+                return result;
+            }
+
+            void reset()
+            {
+                for (auto& shard : shards_)
+                    shard.value.store(0, std::memory_order_relaxed);
+            }
+        private:
+            struct alignas(CACHE_LINE_SIZE) Shard
+            {
+                std::atomic<int64_t> value = 0;
+            };
+
+            Shard shards_[JEB_PROFILER_COUNTER_SHARDS];
+        };
+
+        template <typename Site>
+        class SiteList
+        {
+        public:
+            void add(Site* site)
+            {
+                auto head = head_.load(std::memory_order_relaxed);
+                do
+                {
+                    site->next = head;
+                } while (!head_.compare_exchange_weak(
+                    head, site,
+                    std::memory_order_release,
+                    std::memory_order_relaxed));
+            }
+
+            /**
+             * @brief Returns the sites in the order they were registered.
+             */
+            [[nodiscard]] std::vector<Site*> sites() const
+            {
+                std::vector<Site*> result;
+                for (auto site = head_.load(std::memory_order_acquire);
+                     site; site = site->next)
+                {
+                    result.push_back(site);
+                }
+                return {result.rbegin(), result.rend()};
+            }
+
+            [[nodiscard]] bool empty() const
+            {
+                return head_.load(std::memory_order_acquire) == nullptr;
+            }
+        private:
+            std::atomic<Site*> head_ = nullptr;
+        };
+    }
+
+    /**
+     * @brief An event counter belonging to a single call site.
+     *
+     * The count is split across cache-line aligned shards so that threads
+     * incrementing the same counter do not contend. Sites are never
+     * destroyed before the program exits, which makes it safe to keep
+     * pointers to them in the profiler.
+     */
+    class CounterSite
+    {
+    public:
+        CounterSite(std::string_view name,
+                    std::string_view file_name,
+                    size_t line_no,
+                    internal::SiteList<CounterSite>& list)
+            : name(name),
+              file_name(file_name),
+              line_no(line_no)
+        {
+            list.add(this);
+        }
+
+        void add(int64_t delta)
+        {
+            count_.add(delta);
+        }
+
+        [[nodiscard]] int64_t value() const
+        {
+            return count_.value();
+        }
+
+        /**
+         * @brief Returns the current value and sets the counter to zero.
+         */
+        int64_t take()
+        {
+            return count_.take();
+        }
+
+        void reset()
+        {
+            count_.reset();
+        }
+
+        std::string_view name;
+        std::string_view file_name;
+        size_t line_no;
+        CounterSite* next = nullptr;
+    private:
+        internal::ShardedCounter count_;
+    };
+
+    /**
+     * @brief A gauge belonging to a single call site.
+     *
+     * Keeps the most recently set value as well as the number of updates
+     * and the minimum, mean and maximum of all values.
+     */
+    class GaugeSite
+    {
+    public:
+        GaugeSite(std::string_view name,
+                  std::string_view file_name,
+                  size_t line_no,
+                  internal::SiteList<GaugeSite>& list)
+            : name(name),
+              file_name(file_name),
+              line_no(line_no)
+        {
+            list.add(this);
+        }
+
+        void set(double value)
+        {
+            auto& shard = shards_[internal::counter_shard_index()];
+            auto stamp = std::chrono::steady_clock::now()
+                .time_since_epoch().count();
+            shard.count.fetch_add(1, std::memory_order_relaxed);
+            shard.last.store(value, std::memory_order_relaxed);
+            shard.stamp.store(stamp, std::memory_order_relaxed);
+            internal::atomic_add(shard.sum, value);
+            internal::atomic_min(shard.min, value);
+            internal::atomic_max(shard.max, value);
+        }
+
+        [[nodiscard]] size_t count() const
+        {
+            size_t result = 0;
+            for (const auto& shard : shards_)
+                result += shard.count.load(std::memory_order_relaxed);
+            return result;
+        }
+
+        [[nodiscard]] double last() const
+        {
+            double result = 0;
+            int64_t stamp = std::numeric_limits<int64_t>::min();
+            for (const auto& shard : shards_)
+            {
+                if (shard.count.load(std::memory_order_relaxed) == 0)
+                    continue;
+                auto shard_stamp = shard.stamp.load(std::memory_order_relaxed);
+                if (shard_stamp >= stamp)
+                {
+                    stamp = shard_stamp;
+                    result = shard.last.load(std::memory_order_relaxed);
+                }
+            }
+            return result;
+        }
+
+        [[nodiscard]] double min() const
+        {
+            auto result = std::numeric_limits<double>::infinity();
+            for (const auto& shard : shards_)
+                result = std::min(result, shard.min.load(std::memory_order_relaxed));
+            return result;
+        }
+
+        [[nodiscard]] double max() const
+        {
+            auto result = -std::numeric_limits<double>::infinity();
+            for (const auto& shard : shards_)
+                result = std::max(result, shard.max.load(std::memory_order_relaxed));
+            return result;
+        }
+
+        [[nodiscard]] double mean() const
+        {
+            double sum = 0;
+            for (const auto& shard : shards_)
+                sum += shard.sum.load(std::memory_order_relaxed);
+            auto n = count();
+            return n != 0 ? sum / double(n) : 0.0;
+        }
+
+        void reset()
+        {
+            for (auto& shard : shards_)
+            {
+                shard.count.store(0, std::memory_order_relaxed);
+                shard.last.store(0, std::memory_order_relaxed);
+                shard.sum.store(0, std::memory_order_relaxed);
+                shard.min.store(std::numeric_limits<double>::infinity(),
+                                std::memory_order_relaxed);
+                shard.max.store(-std::numeric_limits<double>::infinity(),
+                                std::memory_order_relaxed);
+            }
+        }
+
+        std::string_view name;
+        std::string_view file_name;
+        size_t line_no;
+        GaugeSite* next = nullptr;
+    private:
+        struct alignas(internal::CACHE_LINE_SIZE) Shard
+        {
+            std::atomic<size_t> count = 0;
+            std::atomic<int64_t> stamp = 0;
+            std::atomic<double> last = 0;
+            std::atomic<double> sum = 0;
+            std::atomic<double> min = std::numeric_limits<double>::infinity();
+            std::atomic<double> max = -std::numeric_limits<double>::infinity();
+        };
+
+        Shard shards_[JEB_PROFILER_COUNTER_SHARDS];
+    };
+}
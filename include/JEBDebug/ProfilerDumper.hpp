@@ -0,0 +1,220 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Profiler.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define INTERNAL_JEB_PROFILER_HAS_SIGACTION
+    #include <signal.h>
+#endif
+
+namespace JEBDebug
+{
+    struct ProfilerDumpOptions
+    {
+        /// The file the reports are written to.
+        std::string report_path;
+
+        /// A report is written whenever this file appears. The file is
+        /// removed once the report has been written. No file is watched
+        /// if the path is empty.
+        std::string control_path;
+
+        /// A report is written whenever the process receives this signal.
+        /// Set to 0 to disable. Ignored on platforms without sigaction.
+        int signal_number =
+#ifdef INTERNAL_JEB_PROFILER_HAS_SIGACTION
+            SIGUSR2;
+#else
+            0;
+#endif
+
+        /// Reset the profiler after each report, making each report
+        /// cover the interval since the previous one.
+        bool reset_after_dump = false;
+
+        /// Append each report to report_path instead of replacing it.
+        bool append = false;
+
+        /// How often the background thread checks for the control file
+        /// and for received signals.
+        std::chrono::milliseconds poll_interval{100};
+    };
+
+    /**
+     * @brief Writes profiler reports from a background thread on request.
+     *
+     * Intended for long-running processes that never reach
+     * JEB_PROFILER_REPORT(). The reports are written while the profiled
+     * threads keep running, they are never stopped or locked.
+     *
+     * Only one dumper should be active at a time.
+     */
+    class ProfilerDumper
+    {
+    public:
+        explicit ProfilerDumper(ProfilerDumpOptions options)
+            : options_(std::move(options))
+        {
+            install_signal_handler();
+            thread_ = std::thread([this] {run();});
+        }
+
+        ProfilerDumper(const ProfilerDumper&) = delete;
+
+        ProfilerDumper& operator=(const ProfilerDumper&) = delete;
+
+        ~ProfilerDumper()
+        {
+            {
+                std::lock_guard lock(mutex_);
+                stop_ = true;
+            }
+            condition_.notify_one();
+            thread_.join();
+            restore_signal_handler();
+        }
+
+        /**
+         * @brief Makes the background thread write a report as soon as
+         *  possible.
+         */
+        void request_dump()
+        {
+            dump_requested().store(true, std::memory_order_relaxed);
+            condition_.notify_one();
+        }
+
+        /**
+         * @brief Writes a report immediately from the calling thread.
+         */
+        void dump()
+        {
+            auto mode = options_.append ? std::ios::app : std::ios::trunc;
+            auto path = options_.append ? options_.report_path
+                                        : options_.report_path + ".tmp";
+            {
+                std::ofstream file(path, std::ios::out | mode);
+                if (!file)
+                    return;
+                if (options_.append)
+                    file << "# " << timestamp() << '\n';
+                if (options_.reset_after_dump)
+                    Profiler::instance().write_and_clear(file);
+                else
+                    Profiler::instance().write(file);
+                if (options_.append)
+                    file << '\n';
+            }
+            // Replace the previous report in a single step to avoid that
+            // readers ever see a partially written file.
+            if (!options_.append)
+            {
+                std::error_code ec;
+                std::filesystem::rename(path, options_.report_path, ec);
+            }
+        }
+    private:
+        static std::atomic<bool>& dump_requested()
+        {
+            static std::atomic<bool> flag(false);
+            return flag;
+        }
+
+        static void signal_handler(int)
+        {
+            dump_requested().store(true, std::memory_order_relaxed);
+        }
+
+        void run()
+        {
+            std::unique_lock lock(mutex_);
+            while (!stop_)
+            {
+                condition_.wait_for(lock, options_.poll_interval);
+                if (stop_)
+                    break;
+                bool dump_now = dump_requested().exchange(
+                    false, std::memory_order_relaxed);
+                if (!options_.control_path.empty())
+                {
+                    std::error_code ec;
+                    if (std::filesystem::exists(options_.control_path, ec))
+                    {
+                        std::filesystem::remove(options_.control_path, ec);
+                        dump_now = true;
+                    }
+                }
+                if (dump_now)
+                {
+                    lock.unlock();
+                    dump();
+                    lock.lock();
+                }
+            }
+        }
+
+        static std::string timestamp()
+        {
+            auto now = std::chrono::system_clock::to_time_t(
+                std::chrono::system_clock::now());
+            std::tm tm = {};
+#ifdef _WIN32
+            localtime_s(&tm, &now);
+#else
+            localtime_r(&now, &tm);
+#endif
+            char buffer[32];
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+            return buffer;
+        }
+
+        void install_signal_handler()
+        {
+#ifdef INTERNAL_JEB_PROFILER_HAS_SIGACTION
+            if (options_.signal_number == 0)
+                return;
+            struct sigaction action = {};
+            action.sa_handler = signal_handler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            if (sigaction(options_.signal_number, &action, &old_action_) == 0)
+                handler_installed_ = true;
+#endif
+        }
+
+        void restore_signal_handler()
+        {
+#ifdef INTERNAL_JEB_PROFILER_HAS_SIGACTION
+            if (handler_installed_)
+                sigaction(options_.signal_number, &old_action_, nullptr);
+#endif
+        }
+
+        ProfilerDumpOptions options_;
+        std::thread thread_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        bool stop_ = false;
+#ifdef INTERNAL_JEB_PROFILER_HAS_SIGACTION
+        struct sigaction old_action_ = {};
+        bool handler_installed_ = false;
+#endif
+    };
+}
@@ -0,0 +1,134 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include "ProfilerCounters.hpp"
+
+namespace JEBDebug
+{
+    /**
+     * @brief A snapshot of the statistics for a lock.
+     */
+    struct LockData
+    {
+        using Duration = std::chrono::high_resolution_clock::duration;
+
+        size_t acquisitions = 0;
+        size_t contended = 0;
+        size_t max_waiters = 0;
+        Duration wait_time = {};
+        Duration max_wait_time = {};
+        size_t hold_samples = 0;
+        Duration hold_time = {};
+        Duration max_hold_time = {};
+        size_t shared_hold_samples = 0;
+        Duration shared_hold_time = {};
+        Duration max_shared_hold_time = {};
+    };
+
+    /**
+     * @brief Collects the statistics for all ProfiledMutexes with the
+     *  same name.
+     *
+     * Acquisitions are counted in per-thread shards, while the remaining
+     * statistics are only updated when a thread had to wait or when
+     * an acquisition is sampled for its hold time.
+     */
+    class LockStats
+    {
+    public:
+        using Duration = LockData::Duration;
+
+        void add_acquisition()
+        {
+            acquisitions_.add(1);
+        }
+
+        void add_wait(Duration time, size_t waiters)
+        {
+            using std::memory_order_relaxed;
+            contended_.fetch_add(1, memory_order_relaxed);
+            wait_time_.fetch_add(time.count(), memory_order_relaxed);
+            internal::atomic_max(max_wait_time_, time.count());
+            internal::atomic_max(max_waiters_, waiters);
+        }
+
+        void add_hold(Duration time)
+        {
+            using std::memory_order_relaxed;
+            hold_samples_.fetch_add(1, memory_order_relaxed);
+            hold_time_.fetch_add(time.count(), memory_order_relaxed);
+            internal::atomic_max(max_hold_time_, time.count());
+        }
+
+        void add_shared_hold(Duration time)
+        {
+            using std::memory_order_relaxed;
+            shared_hold_samples_.fetch_add(1, memory_order_relaxed);
+            shared_hold_time_.fetch_add(time.count(), memory_order_relaxed);
+            internal::atomic_max(max_shared_hold_time_, time.count());
+        }
+
+        [[nodiscard]] LockData snapshot() const
+        {
+            using std::memory_order_relaxed;
+            LockData result;
+            result.acquisitions = size_t(acquisitions_.value());
+            result.contended = contended_.load(memory_order_relaxed);
+            result.max_waiters = max_waiters_.load(memory_order_relaxed);
+            result.wait_time = Duration(wait_time_.load(memory_order_relaxed));
+            result.max_wait_time = Duration(max_wait_time_.load(memory_order_relaxed));
+            result.hold_samples = hold_samples_.load(memory_order_relaxed);
+            result.hold_time = Duration(hold_time_.load(memory_order_relaxed));
+            result.max_hold_time = Duration(max_hold_time_.load(memory_order_relaxed));
+            result.shared_hold_samples = shared_hold_samples_.load(memory_order_relaxed);
+            result.shared_hold_time = Duration(shared_hold_time_.load(memory_order_relaxed));
+            result.max_shared_hold_time = Duration(max_shared_hold_time_.load(memory_order_relaxed));
+            return result;
+        }
+
+        /**
+         * @brief Returns a snapshot of the statistics and resets them.
+         */
+        LockData take()
+        {
+            using std::memory_order_relaxed;
+            LockData result;
+            result.acquisitions = size_t(acquisitions_.take());
+            result.contended = contended_.exchange(0, memory_order_relaxed);
+            result.max_waiters = max_waiters_.exchange(0, memory_order_relaxed);
+            result.wait_time = Duration(wait_time_.exchange(0, memory_order_relaxed));
+            result.max_wait_time = Duration(max_wait_time_.exchange(0, memory_order_relaxed));
+            result.hold_samples = hold_samples_.exchange(0, memory_order_relaxed);
+            result.hold_time = Duration(hold_time_.exchange(0, memory_order_relaxed));
+            result.max_hold_time = Duration(max_hold_time_.exchange(0, memory_order_relaxed));
+            result.shared_hold_samples = shared_hold_samples_.exchange(0, memory_order_relaxed);
+            result.shared_hold_time = Duration(shared_hold_time_.exchange(0, memory_order_relaxed));
+            result.max_shared_hold_time = Duration(max_shared_hold_time_.exchange(0, memory_order_relaxed));
+            return result;
+        }
+    private:
+        using Rep = Duration::rep;
+
+        internal::ShardedCounter acquisitions_;
+        alignas(internal::CACHE_LINE_SIZE) std::atomic<size_t> contended_ = 0;
+        std::atomic<size_t> max_waiters_ = 0;
+        std::atomic<Rep> wait_time_ = 0;
+        std::atomic<Rep> max_wait_time_ = 0;
+        alignas(internal::CACHE_LINE_SIZE) std::atomic<size_t> hold_samples_ = 0;
+        std::atomic<Rep> hold_time_ = 0;
+        std::atomic<Rep> max_hold_time_ = 0;
+        std::atomic<size_t> shared_hold_samples_ = 0;
+        std::atomic<Rep> shared_hold_time_ = 0;
+        std::atomic<Rep> max_shared_hold_time_ = 0;
+    };
+}
@@ -0,0 +1,211 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+    #include <sched.h>
+    #include <unistd.h>
+#endif
+
+namespace JEBDebug
+{
+    /**
+     * @brief The CPUs of the machine and the NUMA nodes they belong to.
+     *
+     * The node of each CPU is read from /sys/devices/system/node on
+     * Linux. All CPUs belong to node 0 when that information is not
+     * available, and malformed files are ignored.
+     */
+    class CpuTopology
+    {
+    public:
+        CpuTopology()
+        {
+#ifdef __linux__
+            auto count = sysconf(_SC_NPROCESSORS_CONF);
+            nodes_.assign(count > 0 ? size_t(count) : 1, 0);
+            // Node numbers need not be contiguous, e.g. after memory
+            // hot-removal or on machines with CPU-less nodes.
+            std::string node_dir = "/sys/devices/system/node/";
+            for_each_in_list(read_line(node_dir + "online"), [&](size_t node)
+            {
+                auto cpus = read_line(node_dir + "node" + std::to_string(node)
+                                      + "/cpulist");
+                for_each_in_list(cpus, [&](size_t cpu)
+                {
+                    if (cpu < nodes_.size())
+                        nodes_[cpu] = node;
+                    node_count_ = std::max(node_count_, node + 1);
+                });
+            });
+#else
+            nodes_.assign(1, 0);
+#endif
+        }
+
+        /**
+         * @brief Returns the number of the CPU the calling thread runs on,
+         *  or -1 if it isn't known.
+         */
+        static int current_cpu()
+        {
+#ifdef __linux__
+            return sched_getcpu();
+#else
+            return -1;
+#endif
+        }
+
+        [[nodiscard]] size_t cpu_count() const
+        {
+            return nodes_.size();
+        }
+
+        [[nodiscard]] size_t node_count() const
+        {
+            return node_count_;
+        }
+
+        [[nodiscard]] size_t node(size_t cpu) const
+        {
+            return cpu < nodes_.size() ? nodes_[cpu] : 0;
+        }
+    private:
+        static std::string read_line(const std::string& path)
+        {
+            std::ifstream file(path);
+            std::string line;
+            std::getline(file, line);
+            return line;
+        }
+
+        /**
+         * @brief Calls @a fn with each number in @a list, a list such as
+         *  "0-3,8-11".
+         *
+         * Stops at the first malformed range.
+         */
+        template <typename Fn>
+        static void for_each_in_list(const std::string& list, Fn fn)
+        {
+            // Larger ranges than this are treated as malformed.
+            constexpr size_t MAX_RANGE = 1u << 16u;
+            const char* pos = list.data();
+            const char* end = list.data() + list.size();
+            while (pos != end)
+            {
+                size_t first = 0;
+                auto result = std::from_chars(pos, end, first);
+                if (result.ec != std::errc())
+                    return;
+                auto last = first;
+                pos = result.ptr;
+                if (pos != end && *pos == '-')
+                {
+                    result = std::from_chars(pos + 1, end, last);
+                    if (result.ec != std::errc() || last < first
+                        || last - first > MAX_RANGE)
+                    {
+                        return;
+                    }
+                    pos = result.ptr;
+                }
+                for (auto n = first; n <= last; ++n)
+                    fn(n);
+                if (pos == end || *pos != ',')
+                    return;
+                ++pos;
+            }
+        }
+
+        std::vector<size_t> nodes_;
+        size_t node_count_ = 1;
+    };
+
+    /**
+     * @brief A snapshot of the CPU placement of a section.
+     */
+    struct PlacementData
+    {
+        size_t calls = 0;
+        /// The number of calls that ended on a different CPU than they
+        /// started on.
+        size_t migrations = 0;
+        /// The number of calls that ended on a different NUMA node than
+        /// they started on.
+        size_t node_migrations = 0;
+        /// The number of calls that started on each CPU.
+        std::vector<size_t> cpu_calls;
+    };
+
+    /**
+     * @brief Counts the CPUs a section starts on, and how often it
+     *  migrates to another CPU or NUMA node before it ends.
+     */
+    class SectionPlacement
+    {
+    public:
+        void init(const CpuTopology& topology)
+        {
+            topology_ = &topology;
+            cpu_calls_.reset(new std::atomic<size_t>[topology.cpu_count()]);
+            for (size_t i = 0; i < topology.cpu_count(); ++i)
+                cpu_calls_[i].store(0, std::memory_order_relaxed);
+        }
+
+        void add(int start_cpu, int end_cpu)
+        {
+            using std::memory_order_relaxed;
+            auto start = size_t(start_cpu);
+            calls_.fetch_add(1, memory_order_relaxed);
+            if (start < topology_->cpu_count())
+                cpu_calls_[start].fetch_add(1, memory_order_relaxed);
+            if (end_cpu == start_cpu || end_cpu < 0)
+                return;
+            migrations_.fetch_add(1, memory_order_relaxed);
+            if (topology_->node(start) != topology_->node(size_t(end_cpu)))
+                node_migrations_.fetch_add(1, memory_order_relaxed);
+        }
+
+        /**
+         * @brief Returns a snapshot of the placement, and resets it if
+         *  @a reset is true.
+         */
+        PlacementData collect(bool reset)
+        {
+            auto get = [&](std::atomic<size_t>& value)
+            {
+                return reset ? value.exchange(0, std::memory_order_relaxed)
+                             : value.load(std::memory_order_relaxed);
+            };
+
+            PlacementData result;
+            result.calls = get(calls_);
+            result.migrations = get(migrations_);
+            result.node_migrations = get(node_migrations_);
+            for (size_t i = 0; i < topology_->cpu_count(); ++i)
+                result.cpu_calls.push_back(get(cpu_calls_[i]));
+            return result;
+        }
+    private:
+        const CpuTopology* topology_ = nullptr;
+        std::atomic<size_t> calls_ = 0;
+        std::atomic<size_t> migrations_ = 0;
+        std::atomic<size_t> node_migrations_ = 0;
+        std::unique_ptr<std::atomic<size_t>[]> cpu_calls_;
+    };
+}
@@ -0,0 +1,112 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+/*
+ * The C interface of the compiled profiler runtime (the JEBDebug::runtime
+ * and JEBDebug::runtime_shared targets). Every executable and shared
+ * library that uses these functions shares a single profiler.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(JEB_PROFILER_RUNTIME_SHARED)
+    #ifdef JEB_PROFILER_BUILDING_RUNTIME
+        #define JEB_PROFILER_API __declspec(dllexport)
+    #else
+        #define JEB_PROFILER_API __declspec(dllimport)
+    #endif
+#elif defined(__GNUC__)
+    #define JEB_PROFILER_API __attribute__((visibility("default")))
+#else
+    #define JEB_PROFILER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief An opaque handle for a profiled section. */
+typedef struct jeb_section jeb_section;
+
+/**
+ * @brief Returns the section with the given location and name, creating
+ *  it if necessary.
+ *
+ * @a file_name and @a func_name must remain valid for as long as the
+ * profiler is used, string literals and __func__ are fine. @a name may
+ * be NULL, it is copied by the profiler.
+ */
+JEB_PROFILER_API jeb_section* jeb_section_register(const char* file_name,
+                                                   const char* func_name,
+                                                   size_t line_no,
+                                                   const char* name);
+
+/** @brief Starts timing @a section on the calling thread. */
+JEB_PROFILER_API void jeb_scope_enter(jeb_section* section);
+
+/** @brief Stops timing the innermost section on the calling thread. */
+JEB_PROFILER_API void jeb_scope_exit(void);
+
+/**
+ * @brief Adds to the work done by the innermost section on the calling
+ *  thread.
+ */
+JEB_PROFILER_API void jeb_scope_add_work(uint64_t bytes, uint64_t items);
+
+/** @brief Writes the profiler report to stdout. */
+JEB_PROFILER_API void jeb_report(void);
+
+/**
+ * @brief Writes the profiler report to the file at @a path.
+ *
+ * @return 0 if the file could not be written, otherwise 1.
+ */
+JEB_PROFILER_API int jeb_report_to_file(const char* path);
+
+/** @brief Resets all timings, counters and gauges. */
+JEB_PROFILER_API void jeb_clear(void);
+
+/**
+ * @brief Returns the runtime's JEBDebug::Profiler instance.
+ *
+ * Only usable from C++ code that is compiled with the same
+ * JEB_PROFILER_* configuration macros as the runtime. Aborts the program
+ * with a message if @a config_hash differs from the runtime's
+ * JEBDebug::Profiler::config_hash().
+ */
+JEB_PROFILER_API void* jeb_profiler(uint64_t config_hash);
+
+/**
+ * @brief Returns the runtime's JEBDebug::FlightRecorder instance.
+ *
+ * Aborts the program with a message if @a config_hash differs from the
+ * runtime's JEBDebug::FlightRecorder::config_hash().
+ */
+JEB_PROFILER_API void* jeb_flight_recorder(uint64_t config_hash);
+
+/**
+ * @brief Returns the calling thread's profiler call stack.
+ *
+ * Used by Profiler.hpp when JEB_PROFILER_USE_RUNTIME is defined, and
+ * subject to the same restriction as jeb_profiler.
+ */
+JEB_PROFILER_API void* jeb_internal_call_stack(uint64_t config_hash);
+
+/**
+ * @brief Returns the calling thread's flight recorder buffer, or NULL if
+ *  it has none.
+ *
+ * Used by FlightRecorder.hpp when JEB_PROFILER_USE_RUNTIME is defined.
+ */
+JEB_PROFILER_API void* jeb_internal_flight_recorder_buffer(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <cstdint>
+#include "ProfilerRuntime.h"
+
+namespace JEBDebug
+{
+    /**
+     * @brief Times a section with the compiled profiler runtime.
+     */
+    class RuntimeProfilerTimer
+    {
+    public:
+        explicit RuntimeProfilerTimer(jeb_section* section)
+        {
+            jeb_scope_enter(section);
+        }
+
+        RuntimeProfilerTimer(const RuntimeProfilerTimer&) = delete;
+
+        RuntimeProfilerTimer& operator=(const RuntimeProfilerTimer&) = delete;
+
+        ~RuntimeProfilerTimer()
+        {
+            jeb_scope_exit();
+        }
+
+        void add_work(uint64_t bytes, uint64_t items = 0)
+        {
+            jeb_scope_add_work(bytes, items);
+        }
+    };
+}
+
+#define INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER2(name, lineno) name##_##lineno
+#define INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER1(name, lineno) \
+    INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER2(name, lineno)
+#define INTERNAL_JEB_PROFILER_UNIQUE_NAME(name) \
+    INTERNAL_JEB_PROFILER_UNIQUE_NAME_EXPANDER1(name, __LINE__)
+
+// A lightweight alternative to Profiler.hpp that only declares the
+// runtime's C interface. Profiler.hpp provides the complete set of
+// macros, and its definitions take precedence if it is also included.
+#ifndef JEB_PROFILE
+
+#define INTERNAL_JEB_PROFILER_RUNTIME_MACROS
+
+#define JEB_PROFILE() \
+    static ::jeb_section* const \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section) = \
+            ::jeb_section_register(__FILE__, __func__, __LINE__, nullptr); \
+    ::JEBDebug::RuntimeProfilerTimer INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile) \
+        (INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section))
+
+#define JEB_PROFILE_NAMED(name) \
+    static ::jeb_section* const \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section) = \
+            ::jeb_section_register(__FILE__, __func__, __LINE__, name); \
+    ::JEBDebug::RuntimeProfilerTimer INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile) \
+        (INTERNAL_JEB_PROFILER_UNIQUE_NAME(profile_section))
+
+#define JEB_PROFILE_WORK(bytes, items) \
+    ::jeb_scope_add_work(bytes, items)
+
+#define JEB_PROFILER_REPORT() \
+    ::jeb_report()
+
+#endif
@@ -0,0 +1,486 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include "Profiler.hpp"
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#ifdef __GNUC__
+    #include <cxxabi.h>
+#endif
+
+// The maximum number of distinct addresses the sampler keeps counts for.
+#ifndef JEB_SAMPLER_MAX_ADDRESSES
+    #define JEB_SAMPLER_MAX_ADDRESSES 4096
+#endif
+
+// The maximum number of frames in the backtraces taken by the sampler.
+#ifndef JEB_SAMPLER_MAX_BACKTRACE_DEPTH
+    #define JEB_SAMPLER_MAX_BACKTRACE_DEPTH 32
+#endif
+
+// The number of unannotated addresses shown in the report.
+#ifndef JEB_SAMPLER_REPORTED_ADDRESSES
+    #define JEB_SAMPLER_REPORTED_ADDRESSES 20
+#endif
+
+namespace JEBDebug
+{
+    struct ProfilerSamplerOptions
+    {
+        /// The time between samples.
+        std::chrono::microseconds interval{1000};
+
+        /// Measure the interval in CPU time consumed by each thread. If
+        /// false, threads are also sampled while they are blocked.
+        bool cpu_time = true;
+
+        /// The number of return addresses that are collected by following
+        /// frame pointers when a sample hits code outside any profiled
+        /// section. Requires code compiled with -fno-omit-frame-pointer.
+        unsigned backtrace_depth = 0;
+    };
+
+    /**
+     * @brief Counts samples for a fixed set of code addresses.
+     *
+     * Adding samples is lock-free and async-signal-safe. Samples for new
+     * addresses are dropped once the table is full.
+     */
+    class SampleAddressTable
+    {
+    public:
+        struct Entry
+        {
+            uintptr_t address;
+            size_t self;
+            size_t total;
+        };
+
+        SampleAddressTable()
+            : slots_(new Slot[SIZE])
+        {}
+
+        void add(uintptr_t address, bool self)
+        {
+            auto* slot = find_or_insert(address);
+            if (!slot)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            slot->total.fetch_add(1, std::memory_order_relaxed);
+            if (self)
+                slot->self.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::vector<Entry> snapshot(bool reset)
+        {
+            using std::memory_order_relaxed;
+            std::vector<Entry> result;
+            for (size_t i = 0; i < SIZE; ++i)
+            {
+                auto& slot = slots_[i];
+                auto address = slot.address.load(std::memory_order_acquire);
+                if (address == 0)
+                    continue;
+                Entry entry = {address,
+                               reset ? slot.self.exchange(0, memory_order_relaxed)
+                                     : slot.self.load(memory_order_relaxed),
+                               reset ? slot.total.exchange(0, memory_order_relaxed)
+                                     : slot.total.load(memory_order_relaxed)};
+                if (entry.total != 0)
+                    result.push_back(entry);
+            }
+            return result;
+        }
+
+        void clear()
+        {
+            for (size_t i = 0; i < SIZE; ++i)
+            {
+                slots_[i].self.store(0, std::memory_order_relaxed);
+                slots_[i].total.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        [[nodiscard]] size_t dropped() const
+        {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+    private:
+        static constexpr size_t SIZE = JEB_SAMPLER_MAX_ADDRESSES * 2;
+
+        struct Slot
+        {
+            std::atomic<uintptr_t> address = 0;
+            std::atomic<size_t> self = 0;
+            std::atomic<size_t> total = 0;
+        };
+
+        Slot* find_or_insert(uintptr_t address)
+        {
+            auto hash = size_t(address * 0x9E3779B97F4A7C15ull);
+            for (size_t i = 0; i < JEB_SAMPLER_MAX_ADDRESSES; ++i)
+            {
+                auto& slot = slots_[(hash + i) % SIZE];
+                auto slot_address = slot.address.load(std::memory_order_acquire);
+                if (slot_address == address)
+                    return &slot;
+                if (slot_address == 0)
+                {
+                    if (slot.address.compare_exchange_strong(
+                            slot_address, address, std::memory_order_acq_rel))
+                    {
+                        return &slot;
+                    }
+                    if (slot_address == address)
+                        return &slot;
+                }
+            }
+            return nullptr;
+        }
+
+        std::unique_ptr<Slot[]> slots_;
+        std::atomic<size_t> dropped_ = 0;
+    };
+
+    /**
+     * @brief A statistical profiler that samples registered threads at
+     *  regular intervals.
+     *
+     * Each sample is attributed to the innermost JEB_PROFILE section that
+     * is active on the thread. Samples that hit code outside any section
+     * are counted per program counter, and optionally per return address
+     * in a frame-pointer backtrace.
+     *
+     * Every thread that is to be sampled must call add_thread, or use
+     * JEB_SAMPLE_THREAD(). The sampler uses SIGPROF and a POSIX timer per
+     * thread, and is only available on Linux. Addresses are shown with
+     * symbol names when the program is linked with -rdynamic.
+     */
+    class ProfilerSampler : public ProfilerReportSection
+    {
+    public:
+        /**
+         * @brief Returns the sampler. It is created and added to the
+         *  profiler report the first time this function is called.
+         */
+        static ProfilerSampler& instance()
+        {
+            // Never destroyed, as signals may arrive during exit.
+            static auto* sampler = new ProfilerSampler;
+            return *sampler;
+        }
+
+        /**
+         * @brief Sets the options used by subsequent calls to add_thread.
+         */
+        void set_options(const ProfilerSamplerOptions& options)
+        {
+            std::lock_guard lock(mutex_);
+            options_ = options;
+            backtrace_depth_.store(std::min<unsigned>(
+                                       options.backtrace_depth,
+                                       JEB_SAMPLER_MAX_BACKTRACE_DEPTH),
+                                   std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Starts sampling the calling thread.
+         *
+         * @return false if the timer could not be created.
+         */
+        bool add_thread()
+        {
+            auto& state = thread_state();
+            if (state.has_timer)
+                return true;
+
+            std::lock_guard lock(mutex_);
+            install_signal_handler();
+
+            // Make sure all thread-local data that is used by the signal
+            // handler has been allocated.
+            (void)Profiler::call_depth();
+            init_stack_bounds(state);
+
+            sigevent event = {};
+            event.sigev_notify = SIGEV_THREAD_ID;
+            event.sigev_signo = SIGPROF;
+#ifdef sigev_notify_thread_id
+            event.sigev_notify_thread_id = pid_t(syscall(SYS_gettid));
+#else
+            event._sigev_un._tid = pid_t(syscall(SYS_gettid));
+#endif
+            auto clock = options_.cpu_time ? CLOCK_THREAD_CPUTIME_ID
+                                           : CLOCK_MONOTONIC;
+            if (timer_create(clock, &event, &state.timer) != 0)
+                return false;
+
+            auto us = std::max<int64_t>(options_.interval.count(), 1);
+            itimerspec spec = {};
+            spec.it_interval.tv_sec = time_t(us / 1000000);
+            spec.it_interval.tv_nsec = long(us % 1000000) * 1000;
+            spec.it_value = spec.it_interval;
+            if (timer_settime(state.timer, 0, &spec, nullptr) != 0)
+            {
+                timer_delete(state.timer);
+                return false;
+            }
+            state.has_timer = true;
+            return true;
+        }
+
+        /**
+         * @brief Stops sampling the calling thread.
+         */
+        void remove_thread()
+        {
+            auto& state = thread_state();
+            if (!state.has_timer)
+                return;
+            timer_delete(state.timer);
+            state.has_timer = false;
+        }
+
+        void write(std::ostream& os, bool reset) override
+        {
+            auto unannotated = reset
+                               ? unannotated_.exchange(0, std::memory_order_relaxed)
+                               : unannotated_.load(std::memory_order_relaxed);
+            auto entries = addresses_.snapshot(reset);
+            if (unannotated == 0 && entries.empty())
+                return;
+
+            std::sort(entries.begin(), entries.end(),
+                      [](auto& a, auto& b)
+                      {
+                          if (a.self != b.self)
+                              return a.self > b.self;
+                          return a.total > b.total;
+                      });
+            if (entries.size() > JEB_SAMPLER_REPORTED_ADDRESSES)
+                entries.resize(JEB_SAMPLER_REPORTED_ADDRESSES);
+
+            using std::left, std::right, std::setw;
+            os << '\n' << right << setw(10) << "self" << setw(10) << "total"
+               << "  unannotated samples (" << unannotated << ")\n";
+            for (const auto& entry : entries)
+            {
+                os << setw(10) << entry.self << setw(10) << entry.total
+                   << "  ";
+                write_symbol(os, entry.address);
+                os << '\n';
+            }
+            if (auto dropped = addresses_.dropped(); dropped != 0)
+            {
+                os << dropped << " sample(s) did not fit in"
+                   " JEB_SAMPLER_MAX_ADDRESSES ("
+                   << JEB_SAMPLER_MAX_ADDRESSES << ").\n";
+            }
+        }
+
+        void clear() override
+        {
+            unannotated_.store(0, std::memory_order_relaxed);
+            addresses_.clear();
+        }
+    private:
+        ProfilerSampler()
+        {
+            Profiler::instance().add_report_section(*this);
+        }
+
+        struct ThreadState
+        {
+            timer_t timer = {};
+            bool has_timer = false;
+            uintptr_t stack_low = 0;
+            uintptr_t stack_high = 0;
+        };
+
+        static ThreadState& thread_state()
+        {
+            thread_local ThreadState state;
+            return state;
+        }
+
+        static void init_stack_bounds(ThreadState& state)
+        {
+            pthread_attr_t attr;
+            if (pthread_getattr_np(pthread_self(), &attr) != 0)
+                return;
+            void* address = nullptr;
+            size_t size = 0;
+            if (pthread_attr_getstack(&attr, &address, &size) == 0)
+            {
+                state.stack_low = uintptr_t(address);
+                state.stack_high = uintptr_t(address) + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+
+        void install_signal_handler()
+        {
+            if (handler_installed_)
+                return;
+            struct sigaction action = {};
+            action.sa_sigaction = signal_handler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            if (sigaction(SIGPROF, &action, nullptr) == 0)
+                handler_installed_ = true;
+        }
+
+        static void get_registers(void* context, uintptr_t& pc, uintptr_t& fp)
+        {
+            auto* uc = static_cast<ucontext_t*>(context);
+            pc = 0;
+            fp = 0;
+#if defined(__x86_64__)
+            pc = uintptr_t(uc->uc_mcontext.gregs[REG_RIP]);
+            fp = uintptr_t(uc->uc_mcontext.gregs[REG_RBP]);
+#elif defined(__i386__)
+            pc = uintptr_t(uc->uc_mcontext.gregs[REG_EIP]);
+            fp = uintptr_t(uc->uc_mcontext.gregs[REG_EBP]);
+#elif defined(__aarch64__)
+            pc = uintptr_t(uc->uc_mcontext.pc);
+            fp = uintptr_t(uc->uc_mcontext.regs[29]);
+#else
+            (void)uc;
+#endif
+        }
+
+        static void signal_handler(int, siginfo_t*, void* context)
+        {
+            auto saved_errno = errno;
+            if (!Profiler::sample_current_thread())
+                instance().add_unannotated_sample(context);
+            errno = saved_errno;
+        }
+
+        void add_unannotated_sample(void* context)
+        {
+            unannotated_.fetch_add(1, std::memory_order_relaxed);
+            uintptr_t pc, fp;
+            get_registers(context, pc, fp);
+            if (pc == 0)
+                return;
+            addresses_.add(pc, true);
+
+            auto depth = backtrace_depth_.load(std::memory_order_relaxed);
+            const auto& state = thread_state();
+            for (unsigned i = 0; i < depth; ++i)
+            {
+                // A frame starts with the caller's frame pointer followed
+                // by the return address. Stop at anything that doesn't
+                // look like a frame on this thread's stack.
+                if (fp % sizeof(uintptr_t) != 0
+                    || fp < state.stack_low
+                    || fp + 2 * sizeof(uintptr_t) > state.stack_high)
+                {
+                    break;
+                }
+                auto* frame = reinterpret_cast<const uintptr_t*>(fp);
+                auto return_address = frame[1];
+                if (return_address == 0)
+                    break;
+                addresses_.add(return_address, false);
+                if (frame[0] <= fp)
+                    break;
+                fp = frame[0];
+            }
+        }
+
+        static void write_symbol(std::ostream& os, uintptr_t address)
+        {
+            auto flags = os.flags();
+            os << "0x" << std::hex << address;
+            os.flags(flags);
+
+            Dl_info info = {};
+            if (dladdr(reinterpret_cast<void*>(address), &info) == 0)
+                return;
+            if (info.dli_sname)
+            {
+                os << "  ";
+#ifdef __GNUC__
+                int status = 0;
+                auto* name = abi::__cxa_demangle(info.dli_sname, nullptr,
+                                                 nullptr, &status);
+                os << (status == 0 && name ? name : info.dli_sname);
+                std::free(name);
+#else
+                os << info.dli_sname;
+#endif
+                os << " + " << address - uintptr_t(info.dli_saddr);
+            }
+            if (info.dli_fname)
+                os << "  (" << info.dli_fname << ")";
+        }
+
+        std::mutex mutex_;
+        ProfilerSamplerOptions options_;
+        std::atomic<unsigned> backtrace_depth_ = 0;
+        bool handler_installed_ = false;
+        std::atomic<size_t> unannotated_ = 0;
+        SampleAddressTable addresses_;
+    };
+
+    /**
+     * @brief Samples the current thread for the lifetime of the object.
+     */
+    class ProfilerSampledThread
+    {
+    public:
+        ProfilerSampledThread()
+        {
+            ProfilerSampler::instance().add_thread();
+        }
+
+        ProfilerSampledThread(const ProfilerSampledThread&) = delete;
+
+        ProfilerSampledThread& operator=(const ProfilerSampledThread&) = delete;
+
+        ~ProfilerSampledThread()
+        {
+            ProfilerSampler::instance().remove_thread();
+        }
+    };
+}
+
+#define JEB_SAMPLE_THREAD() \
+    ::JEBDebug::ProfilerSampledThread \
+        INTERNAL_JEB_PROFILER_UNIQUE_NAME(sampled_thread)
+
+#else
+
+#define JEB_SAMPLE_THREAD() \
+    do {} while (false)
+
+#endif
@@ -0,0 +1,750 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include "Profiler.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace JEBDebug
+{
+    namespace internal
+    {
+        constexpr uint32_t SHARED_PROFILER_MAGIC = 0x4A454250;
+        constexpr uint32_t SHARED_PROFILER_VERSION = 1;
+    }
+
+    /**
+     * @brief The header at the start of a shared profiler segment.
+     *
+     * A segment consists of the header, the process table, the section
+     * table and a matrix with one row of SharedSectionStats per process
+     * and one column per section. All parts start on a cache line.
+     */
+    struct SharedProfilerHeader
+    {
+        /// Set by the process that creates the segment once the rest of
+        /// the header has been initialized.
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t max_processes;
+        uint32_t max_sections;
+        /// The pid of the process that is currently adding a process or
+        /// a section, or 0.
+        std::atomic<int32_t> lock_owner;
+        std::atomic<uint32_t> section_count;
+        std::atomic<uint32_t> section_overflows;
+        std::atomic<uint32_t> process_overflows;
+    };
+
+    struct SharedProcessEntry
+    {
+        /// 0 if the entry is unused.
+        std::atomic<int32_t> pid;
+    };
+
+    /**
+     * @brief Identifies a section in a shared profiler segment.
+     *
+     * Strings that are too long are truncated. Entries are never changed
+     * once they have been added to the segment.
+     */
+    struct SharedSectionKey
+    {
+        static constexpr size_t FILE_NAME_SIZE = 192;
+        static constexpr size_t FUNC_NAME_SIZE = 128;
+        static constexpr size_t NAME_SIZE = 64;
+
+        uint32_t line_no;
+        char file_name[FILE_NAME_SIZE];
+        char func_name[FUNC_NAME_SIZE];
+        char name[NAME_SIZE];
+
+        void set(const ProfilerSection& section)
+        {
+            line_no = uint32_t(section.line_no);
+            copy(file_name, section.file_name);
+            copy(func_name, section.func_name);
+            copy(name, section.name);
+        }
+
+        [[nodiscard]] bool operator==(const SharedSectionKey& other) const
+        {
+            return line_no == other.line_no
+                   && std::strcmp(file_name, other.file_name) == 0
+                   && std::strcmp(func_name, other.func_name) == 0
+                   && std::strcmp(name, other.name) == 0;
+        }
+    private:
+        template <size_t N>
+        static void copy(char (&dst)[N], std::string_view src)
+        {
+            auto n = std::min(src.size(), N - 1);
+            std::copy_n(src.data(), n, dst);
+            std::fill(dst + n, dst + N, '\0');
+        }
+    };
+
+    /**
+     * @brief A shared profiler segment mapped into the current process.
+     *
+     * The segment has room for max_sections sections followed by an
+     * overflow section that is used by all sections that do not fit.
+     */
+    class SharedProfilerSegment
+    {
+    public:
+        SharedProfilerSegment() = default;
+
+        SharedProfilerSegment(const SharedProfilerSegment&) = delete;
+
+        SharedProfilerSegment& operator=(const SharedProfilerSegment&) = delete;
+
+        ~SharedProfilerSegment()
+        {
+            close();
+        }
+
+        /**
+         * @brief Opens the segment with the given name, or creates it
+         *  if it does not exist.
+         *
+         * The sizes are only used if the segment is created.
+         */
+        bool create(const std::string& name,
+                    uint32_t max_processes,
+                    uint32_t max_sections)
+        {
+            close();
+            max_processes = std::max<uint32_t>(max_processes, 1);
+            auto path = segment_path(name);
+            int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+            if (fd == -1)
+                return errno == EEXIST && open(name, false);
+
+            auto size = segment_size(max_processes, max_sections);
+            if (ftruncate(fd, off_t(size)) != 0 || !map(fd, size, false))
+            {
+                ::close(fd);
+                shm_unlink(path.c_str());
+                return false;
+            }
+            ::close(fd);
+
+            // The memory is zero-filled, only the header and the overflow
+            // section need values.
+            auto& h = header();
+            h.version = internal::SHARED_PROFILER_VERSION;
+            h.max_processes = max_processes;
+            h.max_sections = max_sections;
+            ProfilerSection overflow;
+            overflow.func_name = "[overflow]";
+            key(max_sections).set(overflow);
+            h.magic.store(internal::SHARED_PROFILER_MAGIC,
+                          std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Opens an existing segment.
+         *
+         * Waits briefly for the segment to be initialized if another
+         * process is creating it.
+         */
+        bool open(const std::string& name, bool read_only)
+        {
+            using namespace std::chrono_literals;
+            close();
+            int fd = shm_open(segment_path(name).c_str(),
+                              read_only ? O_RDONLY : O_RDWR, 0);
+            if (fd == -1)
+                return false;
+
+            struct stat st = {};
+            for (int i = 0; ; ++i)
+            {
+                if (fstat(fd, &st) != 0 || i == 100)
+                {
+                    ::close(fd);
+                    return false;
+                }
+                if (size_t(st.st_size) >= sizeof(SharedProfilerHeader))
+                    break;
+                std::this_thread::sleep_for(10ms);
+            }
+
+            bool mapped = map(fd, size_t(st.st_size), read_only);
+            ::close(fd);
+            if (!mapped)
+                return false;
+
+            for (int i = 0; header().magic.load(std::memory_order_acquire)
+                            != internal::SHARED_PROFILER_MAGIC; ++i)
+            {
+                if (i == 100)
+                {
+                    close();
+                    return false;
+                }
+                std::this_thread::sleep_for(10ms);
+            }
+
+            auto& h = header();
+            if (h.version != internal::SHARED_PROFILER_VERSION
+                || h.max_processes == 0
+                || size_ < segment_size(h.max_processes, h.max_sections))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            if (data_)
+                munmap(data_, size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        /**
+         * @brief Removes the segment's name. Processes that have it
+         *  mapped can keep using it.
+         */
+        static bool remove(const std::string& name)
+        {
+            return shm_unlink(segment_path(name).c_str()) == 0;
+        }
+
+        [[nodiscard]] bool is_open() const
+        {
+            return data_ != nullptr;
+        }
+
+        [[nodiscard]] SharedProfilerHeader& header() const
+        {
+            return *reinterpret_cast<SharedProfilerHeader*>(data_);
+        }
+
+        [[nodiscard]] SharedProcessEntry& process(size_t index) const
+        {
+            auto* p = data_ + processes_offset();
+            return reinterpret_cast<SharedProcessEntry*>(p)[index];
+        }
+
+        /**
+         * @brief Returns the key for the section at @a index.
+         *
+         * The key at max_sections is the overflow section.
+         */
+        [[nodiscard]] SharedSectionKey& key(size_t index) const
+        {
+            auto* p = data_ + keys_offset(header().max_processes);
+            return reinterpret_cast<SharedSectionKey*>(p)[index];
+        }
+
+        [[nodiscard]] SharedSectionStats& stats(size_t process,
+                                                size_t section) const
+        {
+            auto& h = header();
+            auto* p = data_ + stats_offset(h.max_processes, h.max_sections);
+            auto* row = reinterpret_cast<SharedSectionStats*>(p)
+                        + process * (h.max_sections + 1);
+            return row[section];
+        }
+
+        /**
+         * @brief Takes the lock that serializes adding processes and
+         *  sections.
+         *
+         * The lock is taken over if the process that holds it has died.
+         */
+        void lock() const
+        {
+            auto& owner = header().lock_owner;
+            auto pid = int32_t(getpid());
+            for (unsigned i = 1; ; ++i)
+            {
+                int32_t expected = 0;
+                if (owner.compare_exchange_weak(expected, pid,
+                                                std::memory_order_acquire,
+                                                std::memory_order_relaxed))
+                {
+                    return;
+                }
+                if (expected != 0 && i % 1024 == 0
+                    && kill(expected, 0) == -1 && errno == ESRCH
+                    && owner.compare_exchange_strong(expected, pid,
+                                                     std::memory_order_acquire))
+                {
+                    return;
+                }
+                sched_yield();
+            }
+        }
+
+        void unlock() const
+        {
+            header().lock_owner.store(0, std::memory_order_release);
+        }
+    private:
+        static constexpr size_t ALIGNMENT = 64;
+
+        static std::string segment_path(const std::string& name)
+        {
+            return name.empty() || name[0] != '/' ? "/" + name : name;
+        }
+
+        static size_t align(size_t n)
+        {
+            return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        }
+
+        static size_t processes_offset()
+        {
+            return align(sizeof(SharedProfilerHeader));
+        }
+
+        static size_t keys_offset(size_t max_processes)
+        {
+            return processes_offset()
+                   + align(max_processes * sizeof(SharedProcessEntry));
+        }
+
+        static size_t stats_offset(size_t max_processes, size_t max_sections)
+        {
+            return keys_offset(max_processes)
+                   + align((max_sections + 1) * sizeof(SharedSectionKey));
+        }
+
+        static size_t segment_size(size_t max_processes, size_t max_sections)
+        {
+            return stats_offset(max_processes, max_sections)
+                   + max_processes * (max_sections + 1)
+                     * sizeof(SharedSectionStats);
+        }
+
+        bool map(int fd, size_t size, bool read_only)
+        {
+            auto prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+            auto* data = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+                return false;
+            data_ = static_cast<char*>(data);
+            size_ = size;
+            return true;
+        }
+
+        char* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    struct SharedProfilerOptions
+    {
+        /// The maximum number of processes that can write to the segment.
+        /// Only used by the process that creates it.
+        uint32_t max_processes = 128;
+
+        /// The maximum number of distinct sections in the segment. Only
+        /// used by the process that creates it.
+        uint32_t max_sections = JEB_PROFILER_MAX_SECTIONS;
+    };
+
+    /**
+     * @brief Copies the timings of all profiled sections into a named
+     *  shared memory segment, where they can be read by other processes.
+     *
+     * Each process gets its own row of statistics in the segment. The
+     * timings are added to the row by the same thread that updates the
+     * process' own profiler, using relaxed atomic operations only.
+     * Processes created with fork() after the profiler has been enabled
+     * automatically get a new row, which makes it suitable for prefork
+     * servers where the parent enables it before starting the workers.
+     *
+     * The rows of processes that have exited are kept, and are only
+     * reused when the process table is full.
+     */
+    class SharedProfiler : private ProfilerSectionObserver
+    {
+    public:
+        /**
+         * @brief Returns the shared profiler.
+         */
+        static SharedProfiler& instance()
+        {
+            // Never destroyed, as profiled code may run during exit and
+            // write to the segment.
+            static auto* profiler = new SharedProfiler;
+            return *profiler;
+        }
+
+        /**
+         * @brief Starts copying the timings to the segment with the
+         *  given name, creating it if it does not exist.
+         *
+         * Can only be called once per process.
+         *
+         * @return false if the segment could not be created or opened,
+         *  or if its process table is full.
+         */
+        bool enable(const std::string& name,
+                    const SharedProfilerOptions& options = {})
+        {
+            std::lock_guard lock(mutex_);
+            if (segment_.is_open())
+                return false;
+            if (!segment_.create(name, options.max_processes,
+                                 options.max_sections))
+            {
+                return false;
+            }
+            if (!claim_process())
+            {
+                segment_.close();
+                return false;
+            }
+            entries_.reset(new Entry[JEB_PROFILER_MAX_SECTIONS + 1]);
+            pthread_atfork(before_fork, after_fork_in_parent,
+                           after_fork_in_child);
+            Profiler::instance().set_section_observer(this);
+            return true;
+        }
+    private:
+        SharedProfiler() = default;
+
+        void section_added(const ProfilerSection& section,
+                           ProfilerAccumulator& data) override
+        {
+            auto index = add_section(section);
+            auto count = entry_count_.load(std::memory_order_relaxed);
+            entries_[count] = {&data, index};
+            entry_count_.store(count + 1, std::memory_order_release);
+            if (process_ != NO_PROCESS)
+                data.set_shared_stats(&segment_.stats(process_, index));
+        }
+
+        /**
+         * @brief Returns the index of @a section in the segment, adding
+         *  it if necessary.
+         */
+        uint32_t add_section(const ProfilerSection& section)
+        {
+            SharedSectionKey key = {};
+            key.set(section);
+            auto& h = segment_.header();
+            segment_.lock();
+            auto count = h.section_count.load(std::memory_order_relaxed);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (segment_.key(i) == key)
+                {
+                    segment_.unlock();
+                    return i;
+                }
+            }
+            if (count == h.max_sections)
+            {
+                h.section_overflows.fetch_add(1, std::memory_order_relaxed);
+                segment_.unlock();
+                return count;
+            }
+            segment_.key(count) = key;
+            h.section_count.store(count + 1, std::memory_order_release);
+            segment_.unlock();
+            return count;
+        }
+
+        /**
+         * @brief Finds a row for the current process in the segment's
+         *  process table and resets it.
+         */
+        bool claim_process()
+        {
+            auto& h = segment_.header();
+            auto pid = int32_t(getpid());
+            segment_.lock();
+            // Prefer a row left behind by an earlier process with the same
+            // pid, then an unused row, then a row of an exited process.
+            auto index = NO_PROCESS;
+            for (int pass = 0; pass < 3 && index == NO_PROCESS; ++pass)
+            {
+                for (uint32_t i = 0; i < h.max_processes; ++i)
+                {
+                    auto p = segment_.process(i).pid.load(std::memory_order_relaxed);
+                    if ((pass == 0 && p == pid) || (pass == 1 && p == 0)
+                        || (pass == 2 && kill(p, 0) == -1 && errno == ESRCH))
+                    {
+                        index = i;
+                        break;
+                    }
+                }
+            }
+            if (index == NO_PROCESS)
+            {
+                h.process_overflows.fetch_add(1, std::memory_order_relaxed);
+                segment_.unlock();
+                process_ = NO_PROCESS;
+                return false;
+            }
+            for (uint32_t i = 0; i <= h.max_sections; ++i)
+                segment_.stats(index, i).reset();
+            segment_.process(index).pid.store(pid, std::memory_order_release);
+            segment_.unlock();
+            process_ = index;
+            return true;
+        }
+
+        // A thread that adds a section while another thread forks would
+        // leave the segment locked by a process that is still alive. The
+        // fork handlers therefore hold the lock during the fork.
+        static void before_fork()
+        {
+            instance().segment_.lock();
+        }
+
+        static void after_fork_in_parent()
+        {
+            instance().segment_.unlock();
+        }
+
+        static void after_fork_in_child()
+        {
+            auto& self = instance();
+            self.segment_.unlock();
+            self.claim_process();
+            auto count = self.entry_count_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto [data, index] = self.entries_[i];
+                data->set_shared_stats(self.process_ == NO_PROCESS
+                                       ? nullptr
+                                       : &self.segment_.stats(self.process_, index));
+            }
+        }
+
+        static constexpr uint32_t NO_PROCESS = ~uint32_t(0);
+
+        struct Entry
+        {
+            ProfilerAccumulator* data;
+            uint32_t index;
+        };
+
+        std::mutex mutex_;
+        SharedProfilerSegment segment_;
+        uint32_t process_ = NO_PROCESS;
+        /// The sections that have been added to the segment by this
+        /// process. Only written by section_added, which the profiler
+        /// never calls concurrently.
+        std::unique_ptr<Entry[]> entries_;
+        std::atomic<size_t> entry_count_ = 0;
+    };
+
+    /**
+     * @brief Writes reports of the statistics in a shared profiler
+     *  segment.
+     *
+     * The reader only maps the segment for reading and can run while
+     * other processes keep writing to it.
+     */
+    class SharedProfilerReader
+    {
+    public:
+        bool open(const std::string& name)
+        {
+            return segment_.open(name, true);
+        }
+
+        /**
+         * @brief Writes the statistics summed over all processes, or
+         *  a separate table for each process if @a per_process is true.
+         */
+        void write(std::ostream& os, bool per_process) const
+        {
+            auto& h = segment_.header();
+            auto section_count = std::min(
+                h.section_count.load(std::memory_order_acquire),
+                h.max_sections);
+
+            std::vector<std::pair<int32_t, uint32_t>> processes;
+            for (uint32_t i = 0; i < h.max_processes; ++i)
+            {
+                auto pid = segment_.process(i).pid.load(std::memory_order_acquire);
+                if (pid != 0)
+                    processes.emplace_back(pid, i);
+            }
+            std::sort(processes.begin(), processes.end());
+
+            auto running = std::count_if(processes.begin(), processes.end(),
+                                         [](auto& p) {return is_running(p.first);});
+            os << processes.size() << " process(es), " << running
+               << " running\n";
+
+            if (per_process)
+            {
+                for (auto [pid, index] : processes)
+                {
+                    os << "\nprocess " << pid
+                       << (is_running(pid) ? "" : " (exited)") << '\n';
+                    std::vector<Row> rows;
+                    for (uint32_t s = 0; s <= section_count; ++s)
+                    {
+                        auto section = s == section_count ? h.max_sections : s;
+                        rows.push_back({&segment_.key(section),
+                                        read(segment_.stats(index, section))});
+                    }
+                    write_table(os, rows);
+                }
+            }
+            else
+            {
+                std::vector<Row> rows;
+                for (uint32_t s = 0; s <= section_count; ++s)
+                {
+                    auto section = s == section_count ? h.max_sections : s;
+                    Row row = {&segment_.key(section), {}};
+                    for (auto [pid, index] : processes)
+                        row.data.add(read(segment_.stats(index, section)));
+                    rows.push_back(row);
+                }
+                os << '\n';
+                write_table(os, rows);
+            }
+
+            if (auto n = h.section_overflows.load(std::memory_order_relaxed))
+            {
+                os << '\n' << n << " section(s) did not fit in the segment ("
+                   << h.max_sections << " sections).\n";
+            }
+            if (auto n = h.process_overflows.load(std::memory_order_relaxed))
+            {
+                os << '\n' << n << " process(es) did not fit in the segment ("
+                   << h.max_processes << " processes).\n";
+            }
+            os.flush();
+        }
+    private:
+        struct Data
+        {
+            uint64_t count = 0;
+            uint64_t acc_time = 0;
+            uint64_t min_time = std::numeric_limits<uint64_t>::max();
+            uint64_t max_time = 0;
+
+            void add(const Data& other)
+            {
+                count += other.count;
+                acc_time += other.acc_time;
+                min_time = std::min(min_time, other.min_time);
+                max_time = std::max(max_time, other.max_time);
+            }
+        };
+
+        struct Row
+        {
+            const SharedSectionKey* key;
+            Data data;
+        };
+
+        static Data read(const SharedSectionStats& stats)
+        {
+            using std::memory_order_relaxed;
+            return {stats.count.load(memory_order_relaxed),
+                    stats.acc_time.load(memory_order_relaxed),
+                    stats.min_time.load(memory_order_relaxed),
+                    stats.max_time.load(memory_order_relaxed)};
+        }
+
+        static bool is_running(int32_t pid)
+        {
+            return kill(pid, 0) == 0 || errno != ESRCH;
+        }
+
+        static void write_table(std::ostream& os, std::vector<Row>& rows)
+        {
+            rows.erase(std::remove_if(rows.begin(), rows.end(),
+                                      [](auto& r) {return r.data.count == 0;}),
+                       rows.end());
+            if (rows.empty())
+            {
+                os << "no timings\n";
+                return;
+            }
+
+            int func_width = 8;
+            int name_width = 0;
+            for (const auto& row : rows)
+            {
+                func_width = std::max(func_width,
+                                      int(std::strlen(row.key->func_name)));
+                name_width = std::max(name_width,
+                                      int(std::strlen(row.key->name)));
+            }
+            // Only show the name column if at least one section has a name.
+            if (name_width != 0)
+                name_width = std::max(name_width, 4);
+
+            auto seconds = [](uint64_t ns) {return double(ns) * 1e-9;};
+
+            using std::left, std::right, std::setw;
+            const int w = 12;
+            os << right << setw(w) << "calls" << " " << setw(w) << "sum"
+               << " " << setw(w) << "min" << " " << setw(w) << "max"
+               << left << "  " << setw(func_width) << "function";
+            if (name_width != 0)
+                os << "  " << setw(name_width) << "name";
+            os << "  file\n";
+            auto flags = os.flags();
+            auto precision = os.precision(6);
+            os << std::fixed;
+            for (const auto& [key, data] : rows)
+            {
+                os << right << setw(w) << data.count
+                   << " " << setw(w) << seconds(data.acc_time)
+                   << " " << setw(w) << seconds(data.min_time)
+                   << " " << setw(w) << seconds(data.max_time)
+                   << "  " << left << setw(func_width) << key->func_name;
+                if (name_width != 0)
+                    os << "  " << setw(name_width) << key->name;
+                if (key->file_name[0] != '\0')
+                    os << "  " << key->file_name << ":" << key->line_no;
+                os << '\n';
+            }
+            os.precision(precision);
+            os.flags(flags);
+        }
+
+        SharedProfilerSegment segment_;
+    };
+}
+
+#endif
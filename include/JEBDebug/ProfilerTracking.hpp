@@ -0,0 +1,407 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ProfilerCounters.hpp"
+
+// The accuracy parameter of the quantile sketches used by JEB_TRACK.
+// Each sketch holds about three times this many values, and the rank
+// error of the quantiles is roughly 1.7 / JEB_PROFILER_TRACK_SKETCH_SIZE.
+#ifndef JEB_PROFILER_TRACK_SKETCH_SIZE
+    #define JEB_PROFILER_TRACK_SKETCH_SIZE 200
+#endif
+
+namespace JEBDebug
+{
+    /**
+     * @brief The count, mean, variance, minimum and maximum of a stream
+     *  of values.
+     *
+     * The mean and variance are computed with Welford's algorithm, and
+     * two instances can be merged without loss of precision.
+     */
+    class RunningStats
+    {
+    public:
+        void add(double value)
+        {
+            ++count_;
+            auto delta = value - mean_;
+            mean_ += delta / double(count_);
+            m2_ += delta * (value - mean_);
+            min_ = std::min(min_, value);
+            max_ = std::max(max_, value);
+        }
+
+        void merge(const RunningStats& other)
+        {
+            if (other.count_ == 0)
+                return;
+            if (count_ == 0)
+            {
+                *this = other;
+                return;
+            }
+            auto n = count_ + other.count_;
+            auto delta = other.mean_ - mean_;
+            mean_ += delta * double(other.count_) / double(n);
+            m2_ += other.m2_ + delta * delta * double(count_)
+                               * double(other.count_) / double(n);
+            count_ = n;
+            min_ = std::min(min_, other.min_);
+            max_ = std::max(max_, other.max_);
+        }
+
+        [[nodiscard]] size_t count() const
+        {
+            return count_;
+        }
+
+        [[nodiscard]] double mean() const
+        {
+            return mean_;
+        }
+
+        /**
+         * @brief Returns the sample variance.
+         */
+        [[nodiscard]] double variance() const
+        {
+            return count_ < 2 ? 0.0 : m2_ / double(count_ - 1);
+        }
+
+        [[nodiscard]] double stddev() const
+        {
+            return std::sqrt(variance());
+        }
+
+        [[nodiscard]] double min() const
+        {
+            return min_;
+        }
+
+        [[nodiscard]] double max() const
+        {
+            return max_;
+        }
+    private:
+        size_t count_ = 0;
+        double mean_ = 0;
+        double m2_ = 0;
+        double min_ = std::numeric_limits<double>::infinity();
+        double max_ = -std::numeric_limits<double>::infinity();
+    };
+
+    /**
+     * @brief A KLL sketch for estimating the quantiles of a stream of
+     *  values in constant space.
+     *
+     * The values are kept in levels where each value on level h stands
+     * for 2^h of the original values. When a level is full, it is sorted
+     * and every other value, starting at a random offset, is moved to
+     * the next level. Sketches can be merged, which makes it possible to
+     * collect values on several threads and combine them afterwards.
+     *
+     * The storage for a level is reserved when the level is created and
+     * kept when the sketch is cleared, adding values therefore only
+     * allocates memory the first time the sketch reaches a new height.
+     */
+    class QuantileSketch
+    {
+    public:
+        explicit QuantileSketch(size_t k = JEB_PROFILER_TRACK_SKETCH_SIZE)
+            : k_(std::max<size_t>(k, 8))
+        {
+            levels_.reserve(MAX_RESERVED_LEVELS);
+            add_level();
+        }
+
+        void add(double value)
+        {
+            levels_[0].push_back(value);
+            if (levels_[0].size() >= capacities_[0])
+                compress();
+        }
+
+        void merge(const QuantileSketch& other)
+        {
+            while (height_ < other.height_)
+                add_level();
+            for (size_t h = 0; h < other.height_; ++h)
+            {
+                levels_[h].insert(levels_[h].end(),
+                                  other.levels_[h].begin(),
+                                  other.levels_[h].end());
+            }
+            compress();
+        }
+
+        /**
+         * @brief Returns an estimate of the value at quantile @a q,
+         *  where 0 <= q <= 1.
+         *
+         * Returns NaN if the sketch is empty.
+         */
+        [[nodiscard]] double quantile(double q) const
+        {
+            std::vector<std::pair<double, uint64_t>> values;
+            uint64_t total = 0;
+            for (size_t h = 0; h < height_; ++h)
+            {
+                for (auto value : levels_[h])
+                    values.emplace_back(value, uint64_t(1) << h);
+                total += uint64_t(levels_[h].size()) << h;
+            }
+            if (values.empty())
+                return std::numeric_limits<double>::quiet_NaN();
+
+            std::sort(values.begin(), values.end());
+            auto target = std::clamp(q, 0.0, 1.0) * double(total);
+            uint64_t rank = 0;
+            for (const auto& [value, weight] : values)
+            {
+                rank += weight;
+                if (double(rank) >= target)
+                    return value;
+            }
+            return values.back().first;
+        }
+
+        void clear()
+        {
+            for (size_t h = 0; h < height_; ++h)
+                levels_[h].clear();
+            height_ = 1;
+            update_capacities();
+        }
+    private:
+        /**
+         * @brief Sets the number of values each level can hold.
+         *
+         * The top level holds k values, and each level below it holds
+         * two thirds as many as the one above, but never fewer than
+         * MIN_CAPACITY.
+         */
+        void update_capacities()
+        {
+            capacities_.resize(height_);
+            double c = double(k_);
+            for (size_t i = capacities_.size(); i-- > 0;)
+            {
+                capacities_[i] = std::max(size_t(std::ceil(c)), MIN_CAPACITY);
+                c *= 2.0 / 3.0;
+            }
+        }
+
+        void add_level()
+        {
+            if (height_ == levels_.size())
+            {
+                // A level never holds more than its capacity as the top
+                // level, k, plus half the capacity of the level below.
+                levels_.emplace_back();
+                levels_.back().reserve(k_ + k_ / 2 + 1);
+            }
+            ++height_;
+            update_capacities();
+        }
+
+        void compress()
+        {
+            for (size_t h = 0; h < height_; ++h)
+            {
+                if (levels_[h].size() < capacities_[h])
+                    continue;
+                if (h + 1 == height_)
+                    add_level();
+
+                auto& level = levels_[h];
+                auto& next = levels_[h + 1];
+                std::sort(level.begin(), level.end());
+                // With an odd number of values, the smallest one stays.
+                auto odd = level.size() % 2;
+                for (auto i = odd + random_bit(); i < level.size(); i += 2)
+                    next.push_back(level[i]);
+                level.resize(odd);
+            }
+        }
+
+        size_t random_bit()
+        {
+            random_state_ ^= random_state_ << 13u;
+            random_state_ ^= random_state_ >> 7u;
+            random_state_ ^= random_state_ << 17u;
+            return size_t(random_state_ >> 63u);
+        }
+
+        static constexpr size_t MIN_CAPACITY = 8;
+        /// Enough for k * 2^31 values without reallocating levels_.
+        static constexpr size_t MAX_RESERVED_LEVELS = 32;
+
+        size_t k_;
+        /// The number of levels in use, levels_ may contain more.
+        size_t height_ = 0;
+        std::vector<std::vector<double>> levels_;
+        std::vector<size_t> capacities_;
+        uint64_t random_state_ = 0x9E3779B97F4A7C15ull;
+    };
+
+    /**
+     * @brief The values tracked by one thread at a JEB_TRACK call site.
+     *
+     * The owning thread and the thread writing the report synchronize
+     * through a spin lock that is practically never contended.
+     */
+    class TrackShard
+    {
+    public:
+        void add(double value)
+        {
+            lock();
+            stats_.add(value);
+            sketch_.add(value);
+            unlock();
+        }
+
+        /**
+         * @brief Merges the shard's values into @a stats and @a sketch,
+         *  and clears the shard if @a reset is true.
+         */
+        void collect(RunningStats& stats, QuantileSketch& sketch, bool reset)
+        {
+            lock();
+            stats.merge(stats_);
+            sketch.merge(sketch_);
+            if (reset)
+            {
+                stats_ = {};
+                sketch_.clear();
+            }
+            unlock();
+        }
+
+        /// Set while a thread owns the shard.
+        std::atomic<bool> in_use = true;
+        TrackShard* next = nullptr;
+    private:
+        void lock()
+        {
+            while (flag_.test_and_set(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+
+        void unlock()
+        {
+            flag_.clear(std::memory_order_release);
+        }
+
+        std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+        RunningStats stats_;
+        QuantileSketch sketch_;
+    };
+
+    /**
+     * @brief The calling thread's shard at a JEB_TRACK call site.
+     *
+     * Releases the shard when the thread exits, which makes it
+     * available to new threads.
+     */
+    struct TrackShardOwner
+    {
+        TrackShard* shard = nullptr;
+
+        ~TrackShardOwner()
+        {
+            if (shard)
+                shard->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    /**
+     * @brief The distribution of the values passed to a JEB_TRACK call
+     *  site.
+     *
+     * Each thread adds its values to its own TrackShard, which it gets
+     * the first time it reaches the call site. The shards are merged
+     * when the report is written. The shards of threads that have
+     * exited keep their values and are reused by new threads, the
+     * number of shards is therefore bounded by the largest number of
+     * threads that have used the call site at the same time.
+     */
+    class TrackSite
+    {
+    public:
+        TrackSite(std::string_view name,
+                  std::string_view file_name,
+                  size_t line_no,
+                  internal::SiteList<TrackSite>& list)
+            : name(name),
+              file_name(file_name),
+              line_no(line_no)
+        {
+            list.add(this);
+        }
+
+        /**
+         * @brief Adds @a value to the calling thread's shard.
+         *
+         * @param owner a thread_local object owned by the call site, a
+         *  shard is assigned to it if it doesn't have one.
+         */
+        void add(TrackShardOwner& owner, double value)
+        {
+            if (!owner.shard)
+                owner.shard = claim_shard();
+            owner.shard->add(value);
+        }
+
+        void collect(RunningStats& stats, QuantileSketch& sketch, bool reset)
+        {
+            for (auto* shard : shards_.sites())
+                shard->collect(stats, sketch, reset);
+        }
+
+        void reset()
+        {
+            RunningStats stats;
+            QuantileSketch sketch;
+            collect(stats, sketch, true);
+        }
+
+        std::string_view name;
+        std::string_view file_name;
+        size_t line_no;
+        TrackSite* next = nullptr;
+    private:
+        TrackShard* claim_shard()
+        {
+            for (auto* shard : shards_.sites())
+            {
+                if (!shard->in_use.load(std::memory_order_relaxed)
+                    && !shard->in_use.exchange(true, std::memory_order_acquire))
+                {
+                    return shard;
+                }
+            }
+            auto* shard = new TrackShard;
+            shards_.add(shard);
+            return shard;
+        }
+
+        internal::SiteList<TrackShard> shards_;
+    };
+}
@@ -0,0 +1,162 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+namespace JEBDebug
+{
+    /**
+     * @brief A fixed-capacity table of interned strings.
+     *
+     * Each distinct string is copied into the table once and given a
+     * small integer id that never changes. Looking up a string that is
+     * already in the table is lock-free, only adding new strings takes a
+     * lock. All memory is allocated by the constructor.
+     *
+     * Id 0 is always the empty string. When the table is full, new
+     * strings are given the id of the string "[overflow]".
+     */
+    class StringTable
+    {
+    public:
+        using Id = uint32_t;
+
+        StringTable(size_t max_strings, size_t buffer_size)
+            : max_strings_(std::max<size_t>(max_strings, 2)),
+              slot_count_(power_of_two_at_least(max_strings_ * 2)),
+              buffer_size_(buffer_size + sizeof(OVERFLOW_TEXT) + 1),
+              strings_(new std::string_view[max_strings_]),
+              slots_(new std::atomic<Id>[slot_count_]),
+              buffer_(new char[buffer_size_])
+        {
+            for (size_t i = 0; i < slot_count_; ++i)
+                slots_[i].store(0, std::memory_order_relaxed);
+            std::lock_guard lock(mutex_);
+            strings_[0] = {};
+            string_count_.store(1, std::memory_order_relaxed);
+            overflow_id_ = insert(OVERFLOW_TEXT, hash(OVERFLOW_TEXT));
+        }
+
+        StringTable(const StringTable&) = delete;
+
+        StringTable& operator=(const StringTable&) = delete;
+
+        Id intern(std::string_view str)
+        {
+            if (str.empty())
+                return 0;
+
+            auto h = hash(str);
+            if (auto id = find(str, h); id != 0)
+                return id;
+
+            std::lock_guard lock(mutex_);
+            if (auto id = find(str, h); id != 0)
+                return id;
+            return insert(str, h);
+        }
+
+        /**
+         * @brief Returns the string with the given id.
+         *
+         * The string is null-terminated and remains valid for the
+         * lifetime of the table.
+         */
+        [[nodiscard]] std::string_view get(Id id) const
+        {
+            if (id >= string_count_.load(std::memory_order_acquire))
+                return {};
+            return strings_[id];
+        }
+
+        [[nodiscard]] size_t overflows() const
+        {
+            return overflows_.load(std::memory_order_relaxed);
+        }
+    private:
+        static constexpr char OVERFLOW_TEXT[] = "[overflow]";
+
+        static size_t power_of_two_at_least(size_t n)
+        {
+            size_t result = 1;
+            while (result < n)
+                result <<= 1u;
+            return result;
+        }
+
+        static uint64_t hash(std::string_view str)
+        {
+            uint64_t h = 14695981039346656037ull;
+            for (auto c : str)
+            {
+                h ^= uint8_t(c);
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        [[nodiscard]] Id find(std::string_view str, uint64_t h) const
+        {
+            auto mask = slot_count_ - 1;
+            for (auto i = size_t(h) & mask; ; i = (i + 1) & mask)
+            {
+                auto id = slots_[i].load(std::memory_order_acquire);
+                if (id == 0)
+                    return 0;
+                if (strings_[id] == str)
+                    return id;
+            }
+        }
+
+        /**
+         * @brief Adds a new string to the table. The caller must hold
+         *  mutex_.
+         */
+        Id insert(std::string_view str, uint64_t h)
+        {
+            auto id = string_count_.load(std::memory_order_relaxed);
+            if (id == max_strings_ || buffer_used_ + str.size() + 1 > buffer_size_)
+            {
+                overflows_.fetch_add(1, std::memory_order_relaxed);
+                return overflow_id_;
+            }
+
+            auto* text = buffer_.get() + buffer_used_;
+            std::copy(str.begin(), str.end(), text);
+            text[str.size()] = '\0';
+            buffer_used_ += str.size() + 1;
+            strings_[id] = {text, str.size()};
+            string_count_.store(id + 1, std::memory_order_release);
+
+            auto mask = slot_count_ - 1;
+            auto i = size_t(h) & mask;
+            while (slots_[i].load(std::memory_order_relaxed) != 0)
+                i = (i + 1) & mask;
+            slots_[i].store(id, std::memory_order_release);
+            return id;
+        }
+
+        size_t max_strings_;
+        size_t slot_count_;
+        size_t buffer_size_;
+        std::unique_ptr<std::string_view[]> strings_;
+        std::unique_ptr<std::atomic<Id>[]> slots_;
+        std::unique_ptr<char[]> buffer_;
+        size_t buffer_used_ = 0;
+        std::atomic<Id> string_count_ = 0;
+        std::atomic<size_t> overflows_ = 0;
+        Id overflow_id_ = 0;
+        std::mutex mutex_;
+    };
+}
@@ -0,0 +1,110 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#define JEB_PROFILER_BUILDING_RUNTIME
+#include "JEBDebug/Profiler.hpp"
+#include "JEBDebug/ProfilerRuntime.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+namespace
+{
+    JEBDebug::ProfilerAccumulator& accumulator(jeb_section* section)
+    {
+        return *reinterpret_cast<JEBDebug::ProfilerAccumulator*>(section);
+    }
+
+    void check_config(const char* function, uint64_t hash,
+                      uint64_t expected_hash)
+    {
+        if (hash == expected_hash)
+            return;
+        std::fprintf(stderr, "JEBDebug: %s: the profiler runtime was built"
+                             " with different JEB_PROFILER_* or"
+                             " JEB_FLIGHT_RECORDER_* configuration macros"
+                             " than the calling code.\n", function);
+        std::abort();
+    }
+}
+
+extern "C"
+{
+    jeb_section* jeb_section_register(const char* file_name,
+                                      const char* func_name,
+                                      size_t line_no,
+                                      const char* name)
+    {
+        auto& profiler = JEBDebug::Profiler::instance();
+        auto& section = name
+                        ? profiler.section(file_name, func_name, line_no,
+                                           std::string_view(name))
+                        : profiler.section(file_name, func_name, line_no);
+        return reinterpret_cast<jeb_section*>(&section);
+    }
+
+    void jeb_scope_enter(jeb_section* section)
+    {
+        JEBDebug::Profiler::instance().start_timer(accumulator(section));
+    }
+
+    void jeb_scope_exit(void)
+    {
+        JEBDebug::Profiler::instance().end_timer();
+    }
+
+    void jeb_scope_add_work(uint64_t bytes, uint64_t items)
+    {
+        JEBDebug::Profiler::instance().add_work(bytes, items);
+    }
+
+    void jeb_report(void)
+    {
+        JEBDebug::Profiler::instance().write();
+    }
+
+    int jeb_report_to_file(const char* path)
+    {
+        std::ofstream file(path);
+        if (!file)
+            return 0;
+        JEBDebug::Profiler::instance().write(file);
+        return file ? 1 : 0;
+    }
+
+    void jeb_clear(void)
+    {
+        JEBDebug::Profiler::instance().clear();
+    }
+
+    void* jeb_profiler(uint64_t config_hash)
+    {
+        check_config("jeb_profiler", config_hash,
+                     JEBDebug::Profiler::config_hash());
+        return &JEBDebug::Profiler::instance();
+    }
+
+    void* jeb_flight_recorder(uint64_t config_hash)
+    {
+        check_config("jeb_flight_recorder", config_hash,
+                     JEBDebug::FlightRecorder::config_hash());
+        return &JEBDebug::FlightRecorder::instance();
+    }
+
+    void* jeb_internal_call_stack(uint64_t config_hash)
+    {
+        check_config("jeb_internal_call_stack", config_hash,
+                     JEBDebug::Profiler::config_hash());
+        return &JEBDebug::Profiler::call_stack();
+    }
+
+    void* jeb_internal_flight_recorder_buffer(void)
+    {
+        return JEBDebug::FlightRecorder::instance().thread_buffer();
+    }
+}
@@ -0,0 +1,92 @@
+/* JEBDebug: C++ macros and functions for debugging and profiling
+ * Copyright 2014 Jan Erik Breimo
+ * All rights reserved.
+ *
+ * This file is distributed under the BSD License.
+ * License text is included with the source distribution.
+ */
+#include "JEBDebug/ProfilerSharedMemory.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace
+{
+    void print_usage(const char* program)
+    {
+        std::cerr << "usage: " << program
+                  << " [--per-process] [--watch SECONDS] [--remove] NAME\n"
+                  "\n"
+                  "Prints the profiler statistics in the shared memory segment\n"
+                  "NAME, which is created by SharedProfiler::enable.\n"
+                  "\n"
+                  "  --per-process    print one table for each process\n"
+                  "  --watch SECONDS  print a new report every SECONDS seconds\n"
+                  "  --remove         remove the segment after printing it\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool per_process = false;
+    bool remove = false;
+    double interval = 0;
+    std::string name;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--per-process")
+        {
+            per_process = true;
+        }
+        else if (arg == "--remove")
+        {
+            remove = true;
+        }
+        else if (arg == "--watch" && i + 1 < argc)
+        {
+            interval = std::atof(argv[++i]);
+        }
+        else if (name.empty() && !arg.empty() && arg[0] != '-')
+        {
+            name = arg;
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (name.empty())
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    JEBDebug::SharedProfilerReader reader;
+    if (!reader.open(name))
+    {
+        std::cerr << argv[0] << ": can not open shared memory segment "
+                  << name << "\n";
+        return 1;
+    }
+
+    reader.write(std::cout, per_process);
+    while (interval > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+        std::cout << '\n';
+        reader.write(std::cout, per_process);
+    }
+
+    if (remove && !JEBDebug::SharedProfilerSegment::remove(name))
+    {
+        std::cerr << argv[0] << ": can not remove shared memory segment "
+                  << name << "\n";
+        return 1;
+    }
+    return 0;
+}